@@ -0,0 +1,3462 @@
+/**
+ * @file brain.cpp
+ * @author Mahyar Mirrashed (mirrashm@myumanitoba.ca)
+ * @brief Simulate Brian's Brain and emit its frames (built into libbrain).
+ * @version 0.2.2
+ * @date 2022-08-10
+ *
+ * @copyright Copyright (c) 2022 Mahyar Mirrashed
+ *
+ */
+
+#include "brain_internal.hpp"
+
+//-----------------------------------------------------------------------------
+// CONSTANTS
+//-----------------------------------------------------------------------------
+
+// default to 60 seconds of video
+#define DEFAULT_FRAME_COUNT 1800
+// default standard high-definition (HD) display resolution (720p)
+#define DEFAULT_COLUMNS 1280
+#define DEFAULT_ROWS    720
+
+// default seeding area for random initialization (always square)
+#define DEFAULT_SEED_AREA 0.4
+// increment of the splitmix64 counter (the golden ratio in 64-bit fixed point)
+#define SEED_GAMMA 0x9e3779b97f4a7c15ull
+
+// default destination of the generated frames ("-" streams to stdout)
+#define DEFAULT_OUTPUT "automaton.avi"
+
+// megabytes the hashlife engine may hold before collecting unused nodes
+#define DEFAULT_HASH_MEMORY 1024
+// approximate bytes held by a hashlife node (store, index entry and bucket)
+// and by a remembered result
+#define HASH_NODE_BYTES   136
+#define HASH_RESULT_BYTES 40
+// state of the cells around the grid in hashlife trees
+#define HASH_WALL 3
+
+// frames colorized ahead of the encoder before the simulation has to wait
+#define DEFAULT_QUEUE_DEPTH 4
+
+// alignment of every grid row in bytes (also the width of the left padding)
+#define GRID_ALIGN 64
+// grids are rounded up to whole huge pages when they are asked for
+#define HUGE_PAGE_SIZE (2 << 20)
+// smallest mapping the frame buffers are carved from
+#define ARENA_CHUNK (8 * HUGE_PAGE_SIZE)
+
+//-----------------------------------------------------------------------------
+// ARGUMENT PARSER SETUP
+//-----------------------------------------------------------------------------
+
+arguments args;
+
+//-----------------------------------------------------------------------------
+// SIMULATION GRID
+//-----------------------------------------------------------------------------
+
+// Bit-sliced grid holding 64 cells per word in two planes, one marking the ON
+// cells and one marking the DYING cells. Bit b of word k of a row is column
+// 64 * k + b. As with grid, both planes are surrounded by a halo of zero words.
+typedef struct {
+  int rows;
+  int cols;
+  int words;       // words holding the interior cells of a row
+  size_t stride;   // words between the start of consecutive rows
+  size_t bytes;    // length of the allocation
+  uint64_t *mem;   // start of the allocation (both planes, including halos)
+  uint64_t *on;    // first interior word of the ON plane
+  uint64_t *dying; // first interior word of the DYING plane
+} bitgrid;
+
+//-----------------------------------------------------------------------------
+// SIMULATION ENGINES
+//-----------------------------------------------------------------------------
+
+// engine running brain() on byte-per-cell grids
+struct byte_engine : engine {
+  grid cur, next;
+  activity cur_live, next_live;
+  population cur_census, next_census;
+  bool counted = false; // cur_census holds the current generation
+
+  byte_engine(const int rows, const int cols);
+  ~byte_engine() override;
+  void step() override;
+  void sweep() override;
+  void read_row(const int i, uint8_t *dst) const override;
+  void read_cells(const int i, const int j, const int n,
+                  uint8_t *dst) const override;
+  void write_row(const int i, const uint8_t *src) override;
+  size_t footprint() const override;
+  int rows() const override { return cur.rows; }
+  int cols() const override { return cur.cols; }
+  bool active(const int i, const int j, const int n) const override;
+  bool census(population &p) const override;
+};
+
+// engine running bitbrain() on bit-sliced grids
+struct bitboard_engine : engine {
+  bitgrid cur, next;
+  activity cur_live, next_live;
+
+  bitboard_engine(const int rows, const int cols);
+  ~bitboard_engine() override;
+  void step() override;
+  void sweep() override;
+  void read_row(const int i, uint8_t *dst) const override;
+  void read_cells(const int i, const int j, const int n,
+                  uint8_t *dst) const override;
+  void write_row(const int i, const uint8_t *src) override;
+  size_t footprint() const override;
+  int rows() const override { return cur.rows; }
+  int cols() const override { return cur.cols; }
+  bool active(const int i, const int j, const int n) const override;
+};
+
+// Engine running the step on an OpenCL device through OpenCV's T-API. Both
+// generations stay in device memory (with a halo of off cells) and are swapped
+// after each step, so only whole frames cross to the host. Rows are accessed
+// through a host copy that is only synchronized when rows are read or written.
+struct gpu_engine : engine {
+  cv::UMat cur, next;
+  cv::ocl::Kernel kernel;
+  mutable cv::Mat host;                  // interior cells, rows x cols
+  mutable std::atomic<bool> host_stale;  // device holds a newer generation
+  std::atomic<bool> device_stale;        // host holds written rows
+  mutable std::mutex lock;               // serializes downloads to host
+
+  gpu_engine(const int rows, const int cols);
+  void step() override;
+  void sweep() override;
+  void read_row(const int i, uint8_t *dst) const override;
+  void write_row(const int i, const uint8_t *src) override;
+  bool read_frame(cv::Mat &cells) const override;
+  size_t footprint() const override;
+  int rows() const override { return host.rows; }
+  int cols() const override { return host.cols; }
+
+private:
+  void sweep(const bool sync);
+  void download() const;
+  void upload();
+};
+
+// OpenCL version of brain_row_scalar(), advancing one cell per work item
+static const char BRAIN_OPENCL[] =
+  "__kernel void brain_step(__global const uchar *src, int src_step,\n"
+  "                         int src_offset, __global uchar *dst,\n"
+  "                         int dst_step, int dst_offset, int rows,\n"
+  "                         int cols) {\n"
+  "  const int j = get_global_id(0), i = get_global_id(1);\n"
+  "  if (i >= rows || j >= cols)\n"
+  "    return;\n"
+  "  src += src_offset + (i + 1) * src_step + j + 1;\n"
+  "  dst += dst_offset + (i + 1) * dst_step + j + 1;\n"
+  "  int tot = 0;\n"
+  "  for (int k = -1; k < 2; k += 1)\n"
+  "    for (int l = -1; l < 2; l += 1)\n"
+  "      tot += src[k * src_step + l] == CELL_ON;\n"
+  "  *dst = src[0] == CELL_ON ? CELL_DYING\n"
+  "       : src[0] == CELL_OFF && tot == 2 ? CELL_ON : CELL_OFF;\n"
+  "}\n";
+
+// byte engine advancing up to depth generations per pass over the grid with
+// brain_blocked() when several generations are taken at once
+struct temporal_engine : byte_engine {
+  int depth;
+  // tile buffers of each thread, kept across passes
+  std::vector<std::vector<uint8_t>> scratch;
+
+  temporal_engine(const int rows, const int cols, const int depth);
+  void advance(const int n) override;
+};
+
+// Node of a hashlife tree, a square of cells 2^level on a side split into four
+// quadrants (nw, ne, sw, se). Nodes of level 0 are single cells, their ids
+// being their states.
+typedef struct {
+  uint32_t child[4];
+  uint32_t level;
+  population census; // of the square, boxed relative to its top left (no hash)
+} hash_node;
+
+// quadrants of a node, looked up to find an identical node already stored
+typedef std::array<uint32_t, 4> hash_key;
+struct hash_key_hash {
+  size_t operator()(const hash_key &k) const;
+};
+
+// Engine storing the grid as a quadtree of hash-consed nodes (hashlife), so
+// identical squares of cells are held once whatever their position. The center
+// of a node advanced by a power of two of generations is remembered, so sparse
+// and repeating patterns are advanced many generations at a time. The grid is
+// surrounded by walls (HASH_WALL cells which never change and are never on),
+// which makes the rule the same everywhere in the tree. Rows are written into
+// the tree by replacing the nodes along their path, and every node counts the
+// cells of its square, so neither takes a pass over the whole grid.
+struct hashlife_engine : engine {
+  int height, width;                             // size of the grid
+  int level;                                     // level of the root
+  uint32_t root;                                 // current generation
+  std::vector<hash_node> nodes;                  // indexed by node id
+  std::unordered_map<hash_key, uint32_t, hash_key_hash> index;
+  std::unordered_map<uint64_t, uint32_t> results; // node << 8 | log2 of
+                                                  // generations to its center
+  std::vector<uint32_t> empty, walls; // all off and all wall node per level
+  size_t budget;                      // bytes held before collecting
+  std::mutex lock;                    // serializes writes to the tree
+
+  hashlife_engine(const int rows, const int cols, const size_t budget);
+  void step() override;
+  void sweep() override;
+  void advance(const int n) override;
+  void read_row(const int i, uint8_t *dst) const override;
+  void write_row(const int i, const uint8_t *src) override;
+  size_t footprint() const override;
+  int rows() const override { return height; }
+  int cols() const override { return width; }
+  bool active(const int i, const int j, const int n) const override;
+  bool census(population &p) const override;
+
+private:
+  void canonicalize();
+  uint32_t join(const uint32_t nw, const uint32_t ne, const uint32_t sw,
+                const uint32_t se);
+  uint32_t center(const uint32_t id);
+  uint32_t across(const uint32_t w, const uint32_t e);
+  uint32_t down(const uint32_t n, const uint32_t s);
+  uint32_t base(const uint32_t id);
+  uint32_t result(const uint32_t id, const int j);
+  uint32_t jump(const int j);
+  uint32_t blank(const int k, const int y, const int x);
+  uint32_t put_row(const uint32_t id, const int k, const int y, const int x,
+                   const uint8_t *src);
+  bool lit(const uint32_t id, const int k, const int y, const int j,
+           const int n) const;
+  void fill_row(const uint32_t id, const int k, const int y, const int x,
+                uint8_t *dst) const;
+  void collect();
+  uint32_t keep(const uint32_t id, std::vector<uint32_t> &remap,
+                std::vector<hash_node> &kept);
+};
+
+//-----------------------------------------------------------------------------
+// ENCODER PIPELINE
+//-----------------------------------------------------------------------------
+
+// sink dropping every frame (only the statistics of the run are kept)
+struct null_sink : sink {
+  null_sink() : sink(NULL, 1, 0, 0) {}
+  void write(const cv::Mat &) override {}
+};
+
+// sink handing every frame of cell states to a function of the library's user
+struct callback_sink : sink {
+  brain_frame_fn fn;
+  void *user;
+
+  callback_sink(brain_frame_fn fn, void *user)
+    : sink(NULL, 1, 0, 0), fn(fn), user(user) {}
+  void write(const cv::Mat &cells) override {
+    fn(cells.ptr(), cells.step, cells.rows, cells.cols, user);
+  }
+};
+
+// sink recording frames as key frames and run-length encoded changes
+struct recording_sink : sink {
+  int fd;
+  int bits;                       // bits per packed cell
+  size_t stride;                  // bytes per packed row
+  int interval;                   // frames from one key frame to the next
+  uint64_t written;               // bytes of the recording already written
+  std::vector<uint8_t> packed[2]; // grids of this frame and the one before
+  std::vector<uint8_t> buffer;    // encoded bytes not yet written
+  std::vector<uint64_t> index;    // offset of each frame
+
+  recording_sink(const char *path, const int rows, const int cols,
+                 const int interval);
+  ~recording_sink() override;
+  void write(const cv::Mat &cells) override;
+  // close the recording with its index and trailer
+  void finish() override;
+  // write out the buffered bytes
+  void flush();
+};
+
+// sink streaming raw frames into a file, a named pipe or stdout
+struct raw_sink : sink {
+  int fd;
+  bool splice; // frames are mapped into a pipe with vmsplice() (no copy)
+  std::vector<struct iovec> iov; // rows of the frame being written
+
+  raw_sink(const char *path, const int rows, const int cols,
+           const uint8_t *palette, const int channels, const int depth);
+  ~raw_sink() override;
+  void write(const cv::Mat &cells) override;
+  int retained() const override;
+};
+
+//-----------------------------------------------------------------------------
+// LIBRARY
+//-----------------------------------------------------------------------------
+
+// simulation handed out by libbrain (see brain.hpp)
+struct brain_sim {
+  engine *e;
+  uint64_t generation;
+};
+
+// sink handed out by libbrain, with the frame the cells are copied into
+struct brain_sink {
+  sink *out;
+  frame_slot slot;
+};
+
+//-----------------------------------------------------------------------------
+// PROTOTYPES
+//-----------------------------------------------------------------------------
+
+static bool activity_near(const activity &a, const int r, const int c);
+static void activity_layout(activity &a, const int rows, const int units,
+                            const int th, const int tw);
+static bool activity_span(const activity &a, const int i, const int u0,
+                          const int u1);
+static void brain_blocked(const grid &__restrict__ in, grid &__restrict__ out,
+                          const int depth,
+                          std::vector<std::vector<uint8_t>> &scratch);
+static void brain_row_scalar(
+  const uint8_t *__restrict__ up, const uint8_t *__restrict__ mid,
+  const uint8_t *__restrict__ down, uint8_t *__restrict__ dst, const int cols
+);
+#if defined(__x86_64__) || defined(__i386__)
+static void brain_row_avx2(
+  const uint8_t *__restrict__ up, const uint8_t *__restrict__ mid,
+  const uint8_t *__restrict__ down, uint8_t *__restrict__ dst, const int cols
+);
+static void brain_row_avx512(
+  const uint8_t *__restrict__ up, const uint8_t *__restrict__ mid,
+  const uint8_t *__restrict__ down, uint8_t *__restrict__ dst, const int cols
+);
+#endif
+#if defined(__ARM_NEON)
+static void brain_row_neon(
+  const uint8_t *__restrict__ up, const uint8_t *__restrict__ mid,
+  const uint8_t *__restrict__ down, uint8_t *__restrict__ dst, const int cols
+);
+#endif
+template <uint16_t B, uint16_t S, int C, neighborhood N>
+static void rule_row(
+  const uint8_t *__restrict__ up, const uint8_t *__restrict__ mid,
+  const uint8_t *__restrict__ down, uint8_t *__restrict__ dst, const int cols
+);
+template <neighborhood N>
+static void rule_row_table(
+  const uint8_t *__restrict__ up, const uint8_t *__restrict__ mid,
+  const uint8_t *__restrict__ down, uint8_t *__restrict__ dst, const int cols
+);
+static row_kernel rule_table_kernel(const automaton_rule &r);
+static row_kernel select_kernel(const simd_isa isa);
+static void bitbrain(const bitgrid &__restrict__ in, bitgrid &__restrict__ out,
+                     const activity &in_live, activity &out_live);
+static bool bitgrid_create(bitgrid &g, const int rows, const int cols);
+static void bitgrid_destroy(bitgrid &g);
+static inline size_t bitgrid_row(const bitgrid &g, const int i);
+static inline bool cells_any(const uint8_t *cells, const int n);
+static inline bool census_row(const uint8_t *cells, const int n, const int i,
+                              const int j, population &p);
+static void census_merge(population &into, const population &p);
+static void census_scan(const engine &e, population &p);
+static void delta_encode(const uint8_t *__restrict__ cur,
+                         const uint8_t *__restrict__ prev, const size_t n,
+                         std::vector<uint8_t> &out);
+static void varint_put(std::vector<uint8_t> &out, uint64_t value);
+#ifdef USE_TRACE
+static void trace_read(uint64_t *counts);
+#endif
+static bool write_frame(const int fd, const cv::Mat &frame,
+                        std::vector<struct iovec> &iov, const bool splice);
+static void colorize_view(const engine &e, frame_slot &slot);
+static void *map_pages(size_t &bytes);
+static void *grid_map(const int rows, const size_t stride, const int planes,
+                      size_t &bytes);
+#if defined(__x86_64__) || defined(__i386__)
+static void palette_row_ssse3(
+  const uint8_t *__restrict__ cells, uint8_t *__restrict__ dst, const int cols,
+  const uint8_t *palette, const int channels
+);
+#endif
+#if defined(__ARM_NEON)
+static void palette_row_neon(
+  const uint8_t *__restrict__ cells, uint8_t *__restrict__ dst, const int cols,
+  const uint8_t *palette, const int channels
+);
+#endif
+static palette_kernel select_palette_kernel(const simd_isa isa);
+
+//-----------------------------------------------------------------------------
+// ARGUMENT PARSER INITIALIZATION
+//-----------------------------------------------------------------------------
+
+row_kernel brain_row = brain_row_scalar;
+palette_kernel palette_row = palette_row_scalar;
+int cell_states = CELL_STATES;
+cv::Vec3b palette_bgr[PALETTE_ENTRIES];
+cv::Vec3b palette_rgb[PALETTE_ENTRIES];
+uint8_t palette_gray[PALETTE_ENTRIES];
+
+// next state of a cell indexed by its state and its number of live neighbors,
+// used by rule_row_table() for rules without a specialized kernel
+static uint8_t rule_table[MAX_CELL_STATES][9];
+
+/**
+ * @brief Turn a list of neighbor counts into a mask.
+ *
+ * @param digits Counts from 0 to 8, such as "345".
+ * @return uint16_t Mask with bit n set for each count n.
+ */
+static constexpr uint16_t counts(const char *digits) {
+  uint16_t mask = 0;
+
+  for (; *digits; digits += 1)
+    mask |= 1 << (*digits - '0');
+
+  return mask;
+}
+
+#define RULE_PRESET(name, birth, survive, states)                              \
+  {name,                                                                       \
+   {counts(birth), counts(survive), states, NEIGHBORHOOD_MOORE},               \
+   rule_row<counts(birth), counts(survive), states, NEIGHBORHOOD_MOORE>}
+
+const rule_preset RULES[] = {
+  RULE_PRESET("brain", "2", "", 3),
+  RULE_PRESET("life", "3", "23", 2),
+  RULE_PRESET("star-wars", "2", "345", 4),
+  RULE_PRESET("frogs", "34", "12", 3),
+  RULE_PRESET("spirals", "234", "2", 5),
+  RULE_PRESET("sticks", "2", "3456", 6),
+  RULE_PRESET("transers", "26", "345", 5),
+  RULE_PRESET("lava", "45678", "12345", 8),
+};
+
+tile_size tile = {DEFAULT_TILE_ROWS, DEFAULT_TILE_COLS};
+frame_view view = {};
+frame_arena pool = {};
+
+// whether brain_setup() has applied the settings of the library's user
+static bool configured = false;
+
+#ifdef USE_TRACE
+std::vector<trace_event> trace_events;
+std::mutex trace_lock;
+std::atomic<uint64_t> trace_region(0);
+#endif
+
+//-----------------------------------------------------------------------------
+// FUNCTIONS
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Set every option to its default value.
+ *
+ * @param a Arguments to reset.
+ */
+void arguments_default(arguments &a) {
+  a.frames = DEFAULT_FRAME_COUNT;
+  a.framed = false;
+  a.columns = DEFAULT_COLUMNS;
+  a.rows = DEFAULT_ROWS;
+  a.viewport = cv::Rect();
+  a.placed = false;
+  a.scale = 1;
+  a.scale_mode = SCALE_MAJORITY;
+  a.simd = SIMD_AUTO;
+  a.engine = ENGINE_BYTE;
+  a.autotune = true;
+  a.threads = 0;
+  a.schedule = SCHEDULE_STATIC;
+  a.chunk = 0;
+  a.queue_depth = DEFAULT_QUEUE_DEPTH;
+  a.encoders = 1;
+  a.segment_frames = DEFAULT_SEGMENT_FRAMES;
+  a.keep_segments = false;
+  a.output = DEFAULT_OUTPUT;
+  a.format = FORMAT_AVI;
+  a.codec = CODEC_FFV1;
+  a.fps = DEFAULT_FPS;
+  a.bitrate = NULL;
+  a.keyframe_interval = DEFAULT_KEYFRAME_INTERVAL;
+  a.replay = NULL;
+  a.replay_from = 0;
+  a.benchmark = false;
+  a.bench_sizes = NULL;
+  a.bench_threads = NULL;
+  a.bench_json = NULL;
+  a.bench_history = NULL;
+  a.bench_tolerance = DEFAULT_BENCH_TOLERANCE;
+  a.verify = false;
+  a.checkpoint = NULL;
+  a.checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+  a.resume = NULL;
+  a.seeded = false;
+  a.frame_stride = 1;
+  a.temporal_depth = DEFAULT_TEMPORAL_DEPTH;
+  a.rule = RULES[0].rule;
+  a.huge_pages = false;
+  a.pin = PIN_NONE;
+  a.preview = PREVIEW_NONE;
+  a.preview_fps = DEFAULT_PREVIEW_FPS;
+  a.hash_memory = DEFAULT_HASH_MEMORY;
+  a.stats = NULL;
+  a.stats_format = STATS_CSV;
+  a.on_cycle = CYCLE_IGNORE;
+  a.trace = NULL;
+  a.jobs = NULL;
+}
+
+/**
+ * @brief Pick the step and palette kernels of --rule and --simd.
+ *
+ * Process-wide, like the rule itself, so every engine steps the same rule.
+ */
+void rule_apply(void) {
+  brain_row = select_rule_kernel(args.rule, args.simd);
+  palette_row = select_palette_kernel(args.simd);
+  cell_states = args.rule.states;
+  palette_fill(cell_states);
+}
+
+/**
+ * @brief Check whether an engine can run a rule.
+ *
+ * @param type Engine to run.
+ * @param r Rule to run.
+ * @return bool Whether the engine's grids can hold the states of the rule
+ * (only the byte grids hold those of rules other than Brian's Brain).
+ */
+bool rule_runs(const engine_type type, const automaton_rule &r) {
+  return type == ENGINE_BYTE || type == ENGINE_TEMPORAL ||
+         same_rule(r, RULES[0].rule);
+}
+
+/**
+ * @brief Append the output options of ffmpeg encoding with a codec.
+ *
+ * @param codec ffmpeg encoder to use.
+ * @param argv Options to append to.
+ */
+void codec_options(const char *codec, std::vector<const char *> &argv) {
+  const size_t n = strlen(codec);
+
+  // VAAPI encoders only take frames uploaded to the device
+  if (n > 6 && strcmp(codec + n - 6, "_vaapi") == 0)
+    argv.insert(argv.end(), {"-vaapi_device", VAAPI_DEVICE, "-vf",
+                             "format=nv12,hwupload"});
+
+  argv.insert(argv.end(), {"-c:v", codec});
+  if (args.bitrate)
+    argv.insert(argv.end(), {"-b:v", args.bitrate});
+}
+
+/**
+ * @brief Check whether a tile or any tile around it is live.
+ *
+ * @param a Activity to check.
+ * @param r Row of the tile.
+ * @param c Column of the tile.
+ * @return bool Whether tile (r, c) can change in the next generation.
+ */
+static bool activity_near(const activity &a, const int r, const int c) {
+  for (int y = std::max(r - 1, 0); y <= std::min(r + 1, a.nr - 1); y += 1)
+    for (int x = std::max(c - 1, 0); x <= std::min(c + 1, a.nc - 1); x += 1)
+      if (a.live[y * a.nc + x])
+        return true;
+
+  return false;
+}
+
+/**
+ * @brief Lay out an activity map for a traversal tile.
+ *
+ * A map is kept as is if it already matches the tile. Otherwise every tile is
+ * marked live since nothing is known about its contents.
+ *
+ * @param a Activity to lay out.
+ * @param rows Number of rows in the grid.
+ * @param units Number of grid units (cells or words) in a row.
+ * @param th Tile height in rows.
+ * @param tw Tile width in grid units.
+ */
+static void activity_layout(activity &a, const int rows, const int units,
+                            const int th, const int tw) {
+  if (!a.live.empty() && a.th == th && a.tw == tw)
+    return;
+
+  a.th = th;
+  a.tw = tw;
+  a.nr = tile_count(rows, th);
+  a.nc = tile_count(units, tw);
+  a.live.assign((size_t)a.nr * a.nc, true);
+}
+
+/**
+ * @brief Check whether any tile covering part of a row is live.
+ *
+ * @param a Activity to check.
+ * @param i Row of the grid.
+ * @param u0 First grid unit (cell or word) of the row.
+ * @param u1 Last grid unit (cell or word) of the row.
+ * @return bool Whether units [u0, u1] of row i may not all be off.
+ */
+static bool activity_span(const activity &a, const int i, const int u0,
+                          const int u1) {
+  if (a.live.empty())
+    return true;
+
+  for (int c = u0 / a.tw; c <= u1 / a.tw; c += 1)
+    if (a.live[(i / a.th) * a.nc + c])
+      return true;
+
+  return false;
+}
+
+/**
+ * @brief Advance the grid by one generation, one tile at a time.
+ *
+ * Tiles with no live tile around them in the previous generation are left
+ * off (cleared only if they were live two generations ago).
+ *
+ * @param in Previous generation of Brian's Brain.
+ * @param out New, current generation of Brian's Brain.
+ * @param in_live Activity of the previous generation.
+ * @param out_live Activity of the new generation (same layout as in_live).
+ * @param census Receives the population of the new generation, counted from
+ * each row while it is still cached (NULL to skip counting).
+ */
+void brain(const grid &__restrict__ in, grid &__restrict__ out,
+           const activity &in_live, activity &out_live, population *census) {
+  const int th = in_live.th, tw = in_live.tw, nc = in_live.nc;
+  const bool listed = args.schedule == SCHEDULE_AUTO;
+  const int chunk = args.chunk ? args.chunk : 1;
+  std::vector<int> &work = out_live.work;
+
+  if (census)
+    *census = EMPTY_POPULATION;
+
+  // only the tiles near activity (or still to be cleared) cost anything, so
+  // a centered seed would leave the threads given the edges idle
+  if (listed) {
+    work.clear();
+    for (int k = 0; k < in_live.nr * nc; k += 1)
+      if (out_live.live[k] || activity_near(in_live, k / nc, k % nc))
+        work.push_back(k);
+  }
+
+  TRACE_REGION();
+#pragma omp parallel
+  {
+    TRACE_THREAD("brain");
+    population local = EMPTY_POPULATION;
+    auto visit = [&](const int r, const int c) {
+      const int j = c * tw, cols = std::min(tw, in.cols - j);
+      const int end = std::min((r + 1) * th, in.rows);
+      uint8_t &live = out_live.live[r * nc + c];
+
+      if (!activity_near(in_live, r, c)) {
+        if (live)
+          for (int i = r * th; i < end; i += 1)
+            memset(grid_row(out, i) + j, CELL_OFF, cols);
+        live = false;
+        return;
+      }
+
+      live = false;
+      for (int i = r * th; i < end; i += 1) {
+        brain_row(
+          grid_row(in, i - 1) + j, grid_row(in, i) + j,
+          grid_row(in, i + 1) + j, grid_row(out, i) + j, cols
+        );
+        if (census)
+          live |= census_row(grid_row(out, i) + j, cols, i, j, local);
+        else
+          live |= cells_any(grid_row(out, i) + j, cols);
+      }
+    };
+
+    if (listed) {
+      // listed in row order, so neighboring tiles still tend to share rows
+#pragma omp for schedule(dynamic, chunk) nowait
+      for (size_t k = 0; k < work.size(); k += 1)
+        visit(work[k] / nc, work[k] % nc);
+    } else {
+      // blocks of a band of rows are visited left to right, so each thread's
+      // input rows stay cached from one row of a block to the next
+#pragma omp for collapse(2) schedule(runtime) nowait
+      for (int r = 0; r < in_live.nr; r += 1)
+        for (int c = 0; c < nc; c += 1)
+          visit(r, c);
+    }
+
+    // each thread's counts are merged once it has run out of blocks
+    if (census) {
+#pragma omp critical
+      census_merge(*census, local);
+    }
+  }
+}
+
+/**
+ * @brief Advance the grid by several generations, one tile at a time.
+ *
+ * Each tile is copied into a thread-local buffer together with depth cells
+ * around it, advanced there by depth generations (the valid region shrinking
+ * by a cell per generation) and only then written to the output grid, so the
+ * grid is streamed through memory once for all of them. The buffers are only
+ * grown, so once the tile and depth are settled a pass allocates nothing.
+ *
+ * @param in Current generation of Brian's Brain.
+ * @param out Receives the generation depth steps later.
+ * @param depth Number of generations to advance.
+ * @param scratch Tile buffers of each thread, kept by the caller.
+ */
+static void brain_blocked(const grid &__restrict__ in, grid &__restrict__ out,
+                          const int depth,
+                          std::vector<std::vector<uint8_t>> &scratch) {
+  const int th = tile.rows, tw = tile.cols ? tile.cols : in.cols;
+  const int nr = tile_count(in.rows, th), nc = tile_count(in.cols, tw);
+  const size_t width = (size_t)tile_count(tw + 2 * depth + 2, GRID_ALIGN) *
+                       GRID_ALIGN;
+  const size_t height = th + 2 * depth + 2;
+
+  if (scratch.size() < (size_t)omp_get_max_threads())
+    scratch.resize(omp_get_max_threads());
+
+  TRACE_REGION();
+#pragma omp parallel
+  {
+    TRACE_THREAD("brain_blocked");
+    std::vector<uint8_t> &own = scratch[omp_get_thread_num()];
+
+    if (own.size() < 2 * width * height)
+      own.resize(2 * width * height);
+
+    uint8_t *buf[2] = {own.data(), own.data() + width * height};
+
+    // each thread's span ends with its last tile, not at a barrier
+#pragma omp for collapse(2) schedule(runtime) nowait
+    for (int r = 0; r < nr; r += 1)
+      for (int c = 0; c < nc; c += 1) {
+        const int r0 = r * th, r1 = std::min(r0 + th, in.rows);
+        const int c0 = c * tw, c1 = std::min(c0 + tw, in.cols);
+        // cells loaded around the tile, including the halo at grid edges
+        const int lr = std::max(-1, r0 - depth);
+        const int hr = std::min(in.rows + 1, r1 + depth);
+        const int lc = std::max(-1, c0 - depth);
+        const int hc = std::min(in.cols + 1, c1 + depth);
+        auto cell = [&](const int b, const int i, const int j) {
+          return buf[b] + (size_t)(i - lr) * width + (j - lc);
+        };
+        bool any = false;
+        int src = 0;
+
+        for (int i = lr; i < hr; i += 1) {
+          memcpy(cell(0, i, lc), grid_row(in, i) + lc, hc - lc);
+          memcpy(cell(1, i, lc), grid_row(in, i) + lc, hc - lc);
+          any |= cells_any(cell(0, i, lc), hc - lc);
+        }
+
+        // an off neighborhood stays off for as many generations as it is wide
+        if (!any) {
+          for (int i = r0; i < r1; i += 1)
+            memset(grid_row(out, i) + c0, CELL_OFF, c1 - c0);
+          continue;
+        }
+
+        for (int g = depth - 1; g >= 0; g -= 1, src ^= 1) {
+          const int i0 = std::max(0, r0 - g), i1 = std::min(in.rows, r1 + g);
+          const int j0 = std::max(0, c0 - g), j1 = std::min(in.cols, c1 + g);
+
+          for (int i = i0; i < i1; i += 1)
+            brain_row(
+              cell(src, i - 1, j0), cell(src, i, j0), cell(src, i + 1, j0),
+              cell(src ^ 1, i, j0), j1 - j0
+            );
+        }
+
+        for (int i = r0; i < r1; i += 1)
+          memcpy(grid_row(out, i) + c0, cell(src, i, c0), c1 - c0);
+      }
+  }
+}
+
+/**
+ * @brief Model of Brian's Brain implemented as cleanly as possible.
+ *
+ * This is the reference every vectorized kernel must agree with.
+ *
+ * @param up Row above the current row.
+ * @param mid Current row of the previous generation.
+ * @param down Row below the current row.
+ * @param dst Current row of the new generation.
+ * @param cols Number of cells to advance.
+ */
+static void brain_row_scalar(
+  const uint8_t *__restrict__ up, const uint8_t *__restrict__ mid,
+  const uint8_t *__restrict__ down, uint8_t *__restrict__ dst, const int cols
+) {
+  for (int j = 0; j < cols; j += 1)
+    if (mid[j] == CELL_ON)
+      dst[j] = CELL_DYING;
+    else if (mid[j] == CELL_DYING)
+      dst[j] = CELL_OFF;
+    else {
+      // search Moore neighborhood for live cells (halo cells are always off)
+      int tot = (up[j - 1] == CELL_ON) + (up[j] == CELL_ON) +
+                (up[j + 1] == CELL_ON) + (mid[j - 1] == CELL_ON) +
+                (mid[j + 1] == CELL_ON) + (down[j - 1] == CELL_ON) +
+                (down[j] == CELL_ON) + (down[j + 1] == CELL_ON);
+
+      // automaton rule dictates turning on only if two neighbor cells are on
+      dst[j] = (tot == 2) ? CELL_ON : CELL_OFF;
+    }
+}
+
+/**
+ * @brief Step kernel of a Generations rule fixed at compile time.
+ *
+ * The counts of the rule are constants, so each test against them folds into
+ * a comparison and the loop vectorizes like the hand-written kernels.
+ *
+ * @tparam B Neighbor counts turning an off cell on.
+ * @tparam S Neighbor counts keeping an on cell on.
+ * @tparam C Number of cell states.
+ * @tparam N Neighborhood whose live cells are counted.
+ * @param up Row above the current row.
+ * @param mid Current row of the previous generation.
+ * @param down Row below the current row.
+ * @param dst Current row of the new generation.
+ * @param cols Number of cells to advance.
+ */
+template <uint16_t B, uint16_t S, int C, neighborhood N>
+static void rule_row(
+  const uint8_t *__restrict__ up, const uint8_t *__restrict__ mid,
+  const uint8_t *__restrict__ down, uint8_t *__restrict__ dst, const int cols
+) {
+  for (int j = 0; j < cols; j += 1) {
+    const uint8_t cell = mid[j];
+    uint8_t tot = (up[j] == CELL_ON) + (mid[j - 1] == CELL_ON) +
+                  (mid[j + 1] == CELL_ON) + (down[j] == CELL_ON);
+    bool born = false, stays = false;
+
+    if constexpr (N == NEIGHBORHOOD_MOORE)
+      tot += (up[j - 1] == CELL_ON) + (up[j + 1] == CELL_ON) +
+             (down[j - 1] == CELL_ON) + (down[j + 1] == CELL_ON);
+
+    for (int n = 0; n <= 8; n += 1) {
+      born |= (B >> n & 1) && tot == n;
+      stays |= (S >> n & 1) && tot == n;
+    }
+
+    if (cell == CELL_OFF)
+      dst[j] = born ? CELL_ON : CELL_OFF;
+    else if (cell == CELL_ON)
+      dst[j] = stays ? CELL_ON : C > CELL_DYING ? CELL_DYING : CELL_OFF;
+    else
+      dst[j] = cell + 1 < C ? cell + 1 : CELL_OFF;
+  }
+}
+
+/**
+ * @brief Step kernel of any Generations rule, looked up in rule_table.
+ *
+ * @tparam N Neighborhood whose live cells are counted.
+ * @param up Row above the current row.
+ * @param mid Current row of the previous generation.
+ * @param down Row below the current row.
+ * @param dst Current row of the new generation.
+ * @param cols Number of cells to advance.
+ */
+template <neighborhood N>
+static void rule_row_table(
+  const uint8_t *__restrict__ up, const uint8_t *__restrict__ mid,
+  const uint8_t *__restrict__ down, uint8_t *__restrict__ dst, const int cols
+) {
+  for (int j = 0; j < cols; j += 1) {
+    int tot = (up[j] == CELL_ON) + (mid[j - 1] == CELL_ON) +
+              (mid[j + 1] == CELL_ON) + (down[j] == CELL_ON);
+
+    if constexpr (N == NEIGHBORHOOD_MOORE)
+      tot += (up[j - 1] == CELL_ON) + (up[j + 1] == CELL_ON) +
+             (down[j - 1] == CELL_ON) + (down[j + 1] == CELL_ON);
+
+    dst[j] = rule_table[mid[j]][tot];
+  }
+}
+
+/**
+ * @brief Parse a rule given by name or by its counts.
+ *
+ * Counts are accepted as survive/birth/states (345/2/4) or, birth first, as
+ * B2/S345/C4 (the states defaulting to 2), either optionally followed by V
+ * for the von Neumann neighborhood.
+ *
+ * @param arg Rule given on the command line.
+ * @param r Receives the rule.
+ * @return bool Whether the rule is valid.
+ */
+bool parse_rule(const char *arg, automaton_rule &r) {
+  const bool bs = *arg == 'B' || *arg == 'b';
+  const char *p = arg + bs;
+  long states = 2;
+  char *end;
+
+  for (const rule_preset &preset : RULES)
+    if (strcmp(arg, preset.name) == 0) {
+      r = preset.rule;
+      return true;
+    }
+
+  auto read_counts = [&](uint16_t &mask) {
+    for (mask = 0; *p >= '0' && *p <= '8'; p += 1)
+      mask |= 1 << (*p - '0');
+  };
+
+  read_counts(bs ? r.birth : r.survive);
+  if (*p++ != '/' || (bs && *p != 'S' && *p != 's'))
+    return false;
+  p += bs;
+  read_counts(bs ? r.survive : r.birth);
+
+  if (*p == '/') {
+    p += 1 + (bs && (p[1] == 'C' || p[1] == 'c'));
+    states = strtol(p, &end, 10);
+    if (end == p)
+      return false;
+    p = end;
+  } else if (!bs) {
+    return false;
+  }
+
+  r.states = states;
+  r.shape = NEIGHBORHOOD_MOORE;
+  if (*p == 'V' || *p == 'v') {
+    r.shape = NEIGHBORHOOD_VON_NEUMANN;
+    p += 1;
+  }
+
+  // a cell without live neighbors being born would light up the whole grid
+  // (and from outside its edges)
+  return *p == '\0' && states >= 2 && states <= MAX_CELL_STATES &&
+         !(r.birth & 1) &&
+         (r.shape == NEIGHBORHOOD_MOORE || (r.birth | r.survive) < 1 << 5);
+}
+
+/**
+ * @brief Check whether two rules behave the same.
+ *
+ * @param a First rule.
+ * @param b Second rule.
+ * @return bool Whether both rules have the same counts, states and shape.
+ */
+bool same_rule(const automaton_rule &a, const automaton_rule &b) {
+  return a.birth == b.birth && a.survive == b.survive &&
+         a.states == b.states && a.shape == b.shape;
+}
+
+/**
+ * @brief Pick the step kernel of a rule.
+ *
+ * @param r Rule to run.
+ * @param isa Instruction set requested on the command line (Brian's Brain).
+ * @return row_kernel Specialized kernel of a preset rule, or the lookup table
+ * kernel (filling rule_table) for any other rule.
+ */
+row_kernel select_rule_kernel(const automaton_rule &r, const simd_isa isa) {
+  if (same_rule(r, RULES[0].rule))
+    return select_kernel(isa);
+
+  for (const rule_preset &preset : RULES)
+    if (same_rule(r, preset.rule))
+      return preset.kernel;
+
+  return rule_table_kernel(r);
+}
+
+/**
+ * @brief Fill rule_table for a rule and pick the kernel looking it up.
+ *
+ * Runs any rule, and serves --verify as the reference of the rules that have
+ * specialized kernels.
+ *
+ * @param r Rule to run.
+ * @return row_kernel Lookup table kernel of the rule's neighborhood.
+ */
+static row_kernel rule_table_kernel(const automaton_rule &r) {
+  for (int s = 0; s < r.states; s += 1)
+    for (int n = 0; n <= 8; n += 1)
+      if (s == CELL_OFF)
+        rule_table[s][n] = r.birth >> n & 1 ? CELL_ON : CELL_OFF;
+      else if (s == CELL_ON)
+        rule_table[s][n] = r.survive >> n & 1 ? CELL_ON
+                           : r.states > CELL_DYING ? CELL_DYING
+                                                   : CELL_OFF;
+      else
+        rule_table[s][n] = s + 1 < r.states ? s + 1 : CELL_OFF;
+
+  if (r.shape == NEIGHBORHOOD_VON_NEUMANN)
+    return rule_row_table<NEIGHBORHOOD_VON_NEUMANN>;
+
+  return rule_row_table<NEIGHBORHOOD_MOORE>;
+}
+
+// The vectorized kernels rely on CELL_ON being the only state with the low bit
+// set: masking a cell with CELL_ON yields 1 for live cells and 0 otherwise, so
+// the Moore neighborhood is summed with plain byte additions. The centre cell
+// is included in the sum since it only matters when it is off.
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * @brief Step kernel processing 32 cells per iteration with AVX2.
+ *
+ * @param up Row above the current row.
+ * @param mid Current row of the previous generation.
+ * @param down Row below the current row.
+ * @param dst Current row of the new generation.
+ * @param cols Number of cells to advance.
+ */
+__attribute__((target("avx2"))) static void brain_row_avx2(
+  const uint8_t *__restrict__ up, const uint8_t *__restrict__ mid,
+  const uint8_t *__restrict__ down, uint8_t *__restrict__ dst, const int cols
+) {
+  const __m256i on = _mm256_set1_epi8(CELL_ON);
+  const __m256i dying = _mm256_set1_epi8(CELL_DYING);
+  const __m256i two = _mm256_set1_epi8(2);
+  int j;
+
+  for (j = 0; j + 32 <= cols; j += 32) {
+    __m256i tot = _mm256_setzero_si256();
+
+    for (const uint8_t *row : {up, mid, down})
+      for (int l = -1; l < 2; l += 1)
+        tot = _mm256_add_epi8(
+          tot,
+          _mm256_and_si256(
+            _mm256_loadu_si256((const __m256i *)(row + j + l)), on
+          )
+        );
+
+    __m256i cell = _mm256_loadu_si256((const __m256i *)(mid + j));
+    __m256i born = _mm256_and_si256(
+      _mm256_cmpeq_epi8(tot, two),
+      _mm256_cmpeq_epi8(cell, _mm256_setzero_si256())
+    );
+    __m256i fade = _mm256_cmpeq_epi8(cell, on);
+
+    _mm256_storeu_si256(
+      (__m256i *)(dst + j),
+      _mm256_or_si256(
+        _mm256_and_si256(born, on), _mm256_and_si256(fade, dying)
+      )
+    );
+  }
+
+  // finish the cells that do not fill a whole vector
+  brain_row_scalar(up + j, mid + j, down + j, dst + j, cols - j);
+}
+
+/**
+ * @brief Step kernel processing 64 cells per iteration with AVX-512BW.
+ *
+ * @param up Row above the current row.
+ * @param mid Current row of the previous generation.
+ * @param down Row below the current row.
+ * @param dst Current row of the new generation.
+ * @param cols Number of cells to advance.
+ */
+__attribute__((target("avx512f,avx512bw"))) static void brain_row_avx512(
+  const uint8_t *__restrict__ up, const uint8_t *__restrict__ mid,
+  const uint8_t *__restrict__ down, uint8_t *__restrict__ dst, const int cols
+) {
+  const __m512i on = _mm512_set1_epi8(CELL_ON);
+  const __m512i dying = _mm512_set1_epi8(CELL_DYING);
+  const __m512i two = _mm512_set1_epi8(2);
+  int j;
+
+  for (j = 0; j + 64 <= cols; j += 64) {
+    __m512i tot = _mm512_setzero_si512();
+
+    for (const uint8_t *row : {up, mid, down})
+      for (int l = -1; l < 2; l += 1)
+        tot = _mm512_add_epi8(
+          tot, _mm512_and_si512(_mm512_loadu_si512(row + j + l), on)
+        );
+
+    __m512i cell = _mm512_loadu_si512(mid + j);
+    __mmask64 born = _mm512_cmpeq_epi8_mask(tot, two) &
+                     _mm512_cmpeq_epi8_mask(cell, _mm512_setzero_si512());
+    __mmask64 fade = _mm512_cmpeq_epi8_mask(cell, on);
+
+    _mm512_storeu_si512(
+      dst + j,
+      _mm512_or_si512(
+        _mm512_maskz_mov_epi8(born, on), _mm512_maskz_mov_epi8(fade, dying)
+      )
+    );
+  }
+
+  // finish the cells that do not fill a whole vector
+  brain_row_scalar(up + j, mid + j, down + j, dst + j, cols - j);
+}
+#endif
+
+#if defined(__ARM_NEON)
+/**
+ * @brief Step kernel processing 16 cells per iteration with NEON.
+ *
+ * @param up Row above the current row.
+ * @param mid Current row of the previous generation.
+ * @param down Row below the current row.
+ * @param dst Current row of the new generation.
+ * @param cols Number of cells to advance.
+ */
+static void brain_row_neon(
+  const uint8_t *__restrict__ up, const uint8_t *__restrict__ mid,
+  const uint8_t *__restrict__ down, uint8_t *__restrict__ dst, const int cols
+) {
+  const uint8x16_t on = vdupq_n_u8(CELL_ON);
+  const uint8x16_t dying = vdupq_n_u8(CELL_DYING);
+  const uint8x16_t two = vdupq_n_u8(2);
+  int j;
+
+  for (j = 0; j + 16 <= cols; j += 16) {
+    uint8x16_t tot = vdupq_n_u8(0);
+
+    for (const uint8_t *row : {up, mid, down})
+      for (int l = -1; l < 2; l += 1)
+        tot = vaddq_u8(tot, vandq_u8(vld1q_u8(row + j + l), on));
+
+    uint8x16_t cell = vld1q_u8(mid + j);
+    uint8x16_t born = vandq_u8(vceqq_u8(tot, two), vceqzq_u8(cell));
+    uint8x16_t fade = vceqq_u8(cell, on);
+
+    vst1q_u8(dst + j, vorrq_u8(vandq_u8(born, on), vandq_u8(fade, dying)));
+  }
+
+  // finish the cells that do not fill a whole vector
+  brain_row_scalar(up + j, mid + j, down + j, dst + j, cols - j);
+}
+#endif
+
+/**
+ * @brief Check whether this machine can run a step kernel.
+ *
+ * @param isa Instruction set of the kernel.
+ * @return bool Whether the kernel is compiled in and supported by the CPU.
+ */
+bool simd_supported(const simd_isa isa) {
+  switch (isa) {
+  case SIMD_AUTO:
+  case SIMD_SCALAR:
+    return true;
+#if defined(__x86_64__) || defined(__i386__)
+  case SIMD_AVX2:
+    return __builtin_cpu_supports("avx2");
+  case SIMD_AVX512:
+    return __builtin_cpu_supports("avx512f") &&
+           __builtin_cpu_supports("avx512bw");
+#endif
+#if defined(__ARM_NEON)
+  case SIMD_NEON:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+/**
+ * @brief Resolve SIMD_AUTO to the widest instruction set the CPU supports.
+ *
+ * @param isa Requested instruction set.
+ * @return simd_isa Instruction set the step kernel is compiled for.
+ */
+simd_isa resolve_isa(const simd_isa isa) {
+  if (isa != SIMD_AUTO)
+    return isa;
+
+  for (simd_isa i : {SIMD_AVX512, SIMD_AVX2, SIMD_NEON})
+    if (simd_supported(i))
+      return i;
+
+  return SIMD_SCALAR;
+}
+
+/**
+ * @brief Pick the step kernel for an instruction set.
+ *
+ * @param isa Requested instruction set (SIMD_AUTO picks the widest one the CPU
+ * supports).
+ * @return row_kernel Kernel used by brain().
+ */
+static row_kernel select_kernel(const simd_isa isa) {
+  switch (resolve_isa(isa)) {
+#if defined(__x86_64__) || defined(__i386__)
+  case SIMD_AVX2:
+    return brain_row_avx2;
+  case SIMD_AVX512:
+    return brain_row_avx512;
+#endif
+#if defined(__ARM_NEON)
+  case SIMD_NEON:
+    return brain_row_neon;
+#endif
+  default:
+    return brain_row_scalar;
+  }
+}
+
+/**
+ * @brief Map a row of cell states to pixels one cell at a time.
+ *
+ * @param cells Cell states of the row.
+ * @param dst Pixels of the row (channels bytes per cell).
+ * @param cols Number of cells in the row.
+ * @param palette Pixel of each cell state (channels bytes each).
+ * @param channels Bytes per pixel.
+ */
+void palette_row_scalar(
+  const uint8_t *__restrict__ cells, uint8_t *__restrict__ dst, const int cols,
+  const uint8_t *palette, const int channels
+) {
+  for (int j = 0; j < cols; j += 1)
+    for (int c = 0; c < channels; c += 1)
+      dst[j * channels + c] = palette[cells[j] * channels + c];
+}
+
+// The vectorized palette kernels look pixels up with byte shuffles. Grayscale
+// rows shuffle a table of one byte per state with the cell states directly.
+// For three channels, the states are first spread so each output byte holds
+// the state of its pixel, which is then combined with the byte's channel to
+// index a table of four bytes per state.
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * @brief Map a row of cell states to pixels, 16 cells at a time with SSSE3.
+ *
+ * @param cells Cell states of the row.
+ * @param dst Pixels of the row (channels bytes per cell).
+ * @param cols Number of cells in the row.
+ * @param palette Pixel of each cell state (channels bytes each).
+ * @param channels Bytes per pixel (1 or 3).
+ */
+__attribute__((target("ssse3"))) static void palette_row_ssse3(
+  const uint8_t *__restrict__ cells, uint8_t *__restrict__ dst, const int cols,
+  const uint8_t *palette, const int channels
+) {
+  uint8_t table[16] = {}, plane[3][16] = {}, spread[3][16], channel[3][16];
+  __m128i lut, planes[3], spreads[3], channel_of[3];
+  int j = 0;
+
+  for (int s = 0; s < std::min(cell_states, channels == 1 ? 16 : 4); s += 1)
+    for (int c = 0; c < channels; c += 1)
+      table[s * (channels == 1 ? 1 : 4) + c] = palette[s * channels + c];
+  for (int k = 0; k < 48; k += 1) {
+    spread[k / 16][k % 16] = k / 3;
+    channel[k / 16][k % 16] = k % 3;
+  }
+
+  for (int s = 0; s < cell_states && channels == 3; s += 1)
+    for (int c = 0; c < 3; c += 1)
+      plane[c][s] = palette[s * 3 + c];
+
+  lut = _mm_loadu_si128((const __m128i *)table);
+  for (int k = 0; k < 3; k += 1) {
+    planes[k] = _mm_loadu_si128((const __m128i *)plane[k]);
+    spreads[k] = _mm_loadu_si128((const __m128i *)spread[k]);
+    channel_of[k] = _mm_loadu_si128((const __m128i *)channel[k]);
+  }
+
+  if (channels == 1)
+    for (; j + 16 <= cols; j += 16)
+      _mm_storeu_si128(
+        (__m128i *)(dst + j),
+        _mm_shuffle_epi8(lut, _mm_loadu_si128((const __m128i *)(cells + j)))
+      );
+  else if (channels == 3 && cell_states > 4)
+    // too many states to interleave the channels in one table, so each channel
+    // is looked up on its own and the bytes of the right channel are picked
+    for (; j + 16 <= cols; j += 16) {
+      __m128i states = _mm_loadu_si128((const __m128i *)(cells + j));
+
+      for (int k = 0; k < 3; k += 1) {
+        __m128i state = _mm_shuffle_epi8(states, spreads[k]);
+        __m128i pixels = _mm_setzero_si128();
+
+        for (int c = 0; c < 3; c += 1)
+          pixels = _mm_or_si128(
+            pixels, _mm_and_si128(
+                      _mm_shuffle_epi8(planes[c], state),
+                      _mm_cmpeq_epi8(channel_of[k], _mm_set1_epi8(c))
+                    )
+          );
+        _mm_storeu_si128((__m128i *)(dst + 3 * j + 16 * k), pixels);
+      }
+    }
+  else if (channels == 3)
+    for (; j + 16 <= cols; j += 16) {
+      __m128i states = _mm_loadu_si128((const __m128i *)(cells + j));
+
+      for (int k = 0; k < 3; k += 1) {
+        __m128i state = _mm_shuffle_epi8(states, spreads[k]);
+        __m128i index = _mm_or_si128(_mm_slli_epi16(state, 2), channel_of[k]);
+
+        _mm_storeu_si128(
+          (__m128i *)(dst + 3 * j + 16 * k), _mm_shuffle_epi8(lut, index)
+        );
+      }
+    }
+
+  // finish the cells that do not fill a whole vector
+  palette_row_scalar(
+    cells + j, dst + j * channels, cols - j, palette, channels
+  );
+}
+#endif
+
+#if defined(__ARM_NEON)
+/**
+ * @brief Map a row of cell states to pixels, 16 cells at a time with NEON.
+ *
+ * @param cells Cell states of the row.
+ * @param dst Pixels of the row (channels bytes per cell).
+ * @param cols Number of cells in the row.
+ * @param palette Pixel of each cell state (channels bytes each).
+ * @param channels Bytes per pixel (1 or 3).
+ */
+static void palette_row_neon(
+  const uint8_t *__restrict__ cells, uint8_t *__restrict__ dst, const int cols,
+  const uint8_t *palette, const int channels
+) {
+  uint8_t table[16] = {}, plane[3][16] = {}, spread[3][16], channel[3][16];
+  uint8x16_t lut, planes[3], spreads[3], channel_of[3];
+  int j = 0;
+
+  for (int s = 0; s < std::min(cell_states, channels == 1 ? 16 : 4); s += 1)
+    for (int c = 0; c < channels; c += 1)
+      table[s * (channels == 1 ? 1 : 4) + c] = palette[s * channels + c];
+  for (int k = 0; k < 48; k += 1) {
+    spread[k / 16][k % 16] = k / 3;
+    channel[k / 16][k % 16] = k % 3;
+  }
+
+  for (int s = 0; s < cell_states && channels == 3; s += 1)
+    for (int c = 0; c < 3; c += 1)
+      plane[c][s] = palette[s * 3 + c];
+
+  lut = vld1q_u8(table);
+  for (int k = 0; k < 3; k += 1) {
+    planes[k] = vld1q_u8(plane[k]);
+    spreads[k] = vld1q_u8(spread[k]);
+    channel_of[k] = vld1q_u8(channel[k]);
+  }
+
+  if (channels == 1)
+    for (; j + 16 <= cols; j += 16)
+      vst1q_u8(dst + j, vqtbl1q_u8(lut, vld1q_u8(cells + j)));
+  else if (channels == 3 && cell_states > 4)
+    // too many states to interleave the channels in one table, so each channel
+    // is looked up on its own and the bytes of the right channel are picked
+    for (; j + 16 <= cols; j += 16) {
+      uint8x16_t states = vld1q_u8(cells + j);
+
+      for (int k = 0; k < 3; k += 1) {
+        uint8x16_t state = vqtbl1q_u8(states, spreads[k]);
+        uint8x16_t pixels = vqtbl1q_u8(planes[0], state);
+
+        for (int c = 1; c < 3; c += 1)
+          pixels = vbslq_u8(
+            vceqq_u8(channel_of[k], vdupq_n_u8(c)),
+            vqtbl1q_u8(planes[c], state), pixels
+          );
+        vst1q_u8(dst + 3 * j + 16 * k, pixels);
+      }
+    }
+  else if (channels == 3)
+    for (; j + 16 <= cols; j += 16) {
+      uint8x16_t states = vld1q_u8(cells + j);
+
+      for (int k = 0; k < 3; k += 1) {
+        uint8x16_t state = vqtbl1q_u8(states, spreads[k]);
+        uint8x16_t index = vorrq_u8(vshlq_n_u8(state, 2), channel_of[k]);
+
+        vst1q_u8(dst + 3 * j + 16 * k, vqtbl1q_u8(lut, index));
+      }
+    }
+
+  // finish the cells that do not fill a whole vector
+  palette_row_scalar(
+    cells + j, dst + j * channels, cols - j, palette, channels
+  );
+}
+#endif
+
+/**
+ * @brief Pick the palette kernel for an instruction set.
+ *
+ * @param isa Instruction set picked for the step kernel (SIMD_SCALAR keeps
+ * the scalar palette kernel as well).
+ * @return palette_kernel Kernel used by the sinks.
+ */
+static palette_kernel select_palette_kernel(const simd_isa isa) {
+  if (isa == SIMD_SCALAR)
+    return palette_row_scalar;
+
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("ssse3"))
+    return palette_row_ssse3;
+#endif
+#if defined(__ARM_NEON)
+  return palette_row_neon;
+#endif
+
+  return palette_row_scalar;
+}
+
+/**
+ * @brief Fill the palettes with a colour per cell state of a rule.
+ *
+ * The refractory states fade from DYING to OFF.
+ *
+ * @param states Number of cell states of the rule.
+ */
+void palette_fill(const int states) {
+  palette_bgr[CELL_OFF] = OFF;
+  palette_bgr[CELL_ON] = ON;
+  for (int s = CELL_DYING; s < states; s += 1)
+    for (int c = 0; c < 3; c += 1)
+      palette_bgr[s][c] = DYING[c] * (states - s) / (states - CELL_DYING);
+
+  // luma as converted by cv::cvtColor
+  for (int s = 0; s < states; s += 1) {
+    const cv::Vec3b &bgr = palette_bgr[s];
+
+    palette_rgb[s] = cv::Vec3b({bgr[2], bgr[1], bgr[0]});
+    palette_gray[s] = lround(0.114 * bgr[0] + 0.587 * bgr[1] + 0.299 * bgr[2]);
+  }
+}
+
+/**
+ * @brief Model of Brian's Brain on bit-sliced grids, 64 cells at a time.
+ *
+ * The eight neighbor planes of a word are summed with a saturating bit-sliced
+ * counter (one word per "at least n live neighbors" bit), so the birth rule is
+ * evaluated for 64 cells with a handful of bitwise operations.
+ *
+ * @param in Previous generation of Brian's Brain.
+ * @param out New, current generation of Brian's Brain.
+ * @param in_live Activity of the previous generation (tile widths in words).
+ * @param out_live Activity of the new generation (same layout as in_live).
+ */
+static void bitbrain(const bitgrid &__restrict__ in, bitgrid &__restrict__ out,
+                     const activity &in_live, activity &out_live) {
+  // cells past the last column of a row must stay off
+  const uint64_t tail = in.cols % 64 ? (UINT64_C(1) << in.cols % 64) - 1 : ~0;
+  const int th = in_live.th, tw = in_live.tw;
+
+#pragma omp parallel for collapse(2) schedule(runtime)
+  for (int r = 0; r < in_live.nr; r += 1)
+    for (int c = 0; c < in_live.nc; c += 1) {
+      const int k0 = c * tw, k1 = std::min((c + 1) * tw, in.words);
+      const int end = std::min((r + 1) * th, in.rows);
+      uint8_t &live = out_live.live[r * in_live.nc + c];
+
+      if (!activity_near(in_live, r, c)) {
+        if (live)
+          for (int i = r * th; i < end; i += 1) {
+            memset(out.on + bitgrid_row(out, i) + k0, 0, (k1 - k0) * 8);
+            memset(out.dying + bitgrid_row(out, i) + k0, 0, (k1 - k0) * 8);
+          }
+        live = false;
+        continue;
+      }
+
+      live = false;
+      for (int i = r * th; i < end; i += 1) {
+        const uint64_t *up = in.on + bitgrid_row(in, i - 1);
+        const uint64_t *mid = in.on + bitgrid_row(in, i);
+        const uint64_t *down = in.on + bitgrid_row(in, i + 1);
+        const uint64_t *fading = in.dying + bitgrid_row(in, i);
+        uint64_t *on = out.on + bitgrid_row(out, i);
+        uint64_t *dying = out.dying + bitgrid_row(out, i);
+        uint64_t any = 0;
+
+        for (int k = k0; k < k1; k += 1) {
+          // neighbors to the west and east, carrying bits across words
+          const uint64_t nbrs[8] = {
+            up[k] << 1 | up[k - 1] >> 63,
+            up[k],
+            up[k] >> 1 | up[k + 1] << 63,
+            mid[k] << 1 | mid[k - 1] >> 63,
+            mid[k] >> 1 | mid[k + 1] << 63,
+            down[k] << 1 | down[k - 1] >> 63,
+            down[k],
+            down[k] >> 1 | down[k + 1] << 63,
+          };
+          uint64_t one = 0, two = 0, three = 0;
+
+          for (uint64_t n : nbrs) {
+            three |= two & n;
+            two |= one & n;
+            one |= n;
+          }
+
+          // ready cells with exactly two live neighbors fire, live cells die
+          on[k] = two & ~three & ~mid[k] & ~fading[k];
+          dying[k] = mid[k];
+
+          if (k == in.words - 1)
+            on[k] &= tail;
+          any |= on[k] | dying[k];
+        }
+
+        live |= any != 0;
+      }
+    }
+}
+
+/**
+ * @brief Allocate a bit-sliced grid with all cells turned off.
+ *
+ * @param g Grid to initialize.
+ * @param rows Number of rows in the grid.
+ * @param cols Number of columns in the grid.
+ * @return bool Whether the grid could be mapped (failures are reported).
+ */
+static bool bitgrid_create(bitgrid &g, const int rows, const int cols) {
+  size_t plane;
+
+  // one halo word on either side of each row, one halo row above and below
+  g.rows = rows;
+  g.cols = cols;
+  g.words = (cols + 63) / 64;
+  g.stride = g.words + 2;
+  plane = (rows + 2) * g.stride;
+
+  g.mem = (uint64_t *)grid_map(rows + 2, g.stride * sizeof(uint64_t), 2,
+                               g.bytes);
+  if (g.mem == NULL) {
+    g.on = g.dying = NULL;
+    return false;
+  }
+  g.on = g.mem + g.stride + 1;
+  g.dying = g.on + plane;
+
+  return true;
+}
+
+/**
+ * @brief Release the memory held by a bit-sliced grid.
+ *
+ * @param g Grid to release.
+ */
+static void bitgrid_destroy(bitgrid &g) {
+  if (g.mem)
+    munmap(g.mem, g.bytes);
+  g.mem = g.on = g.dying = NULL;
+}
+
+/**
+ * @brief Get the offset of a row within the planes of a bit-sliced grid.
+ *
+ * @param g Grid to index.
+ * @param i Row index (-1 and g.rows address the halo rows).
+ * @return size_t Offset of word 0 of row i from g.on (or g.dying).
+ */
+static inline size_t bitgrid_row(const bitgrid &g, const int i) {
+  return (ptrdiff_t)i * g.stride;
+}
+
+byte_engine::byte_engine(const int rows, const int cols) {
+  failed = !grid_create(cur, rows, cols) | !grid_create(next, rows, cols);
+}
+
+byte_engine::~byte_engine() {
+  grid_destroy(cur);
+  grid_destroy(next);
+}
+
+void byte_engine::step() {
+  sweep();
+  std::swap(cur, next);
+  std::swap(cur_live, next_live);
+  std::swap(cur_census, next_census);
+  counted = args.stats || args.on_cycle != CYCLE_IGNORE;
+}
+
+void byte_engine::sweep() {
+  const int tw = tile.cols ? tile.cols : cur.cols;
+
+  activity_layout(cur_live, cur.rows, cur.cols, tile.rows, tw);
+  activity_layout(next_live, cur.rows, cur.cols, tile.rows, tw);
+  brain(cur, next, cur_live, next_live,
+        args.stats || args.on_cycle != CYCLE_IGNORE ? &next_census : NULL);
+}
+
+size_t byte_engine::footprint() const { return (cur.rows + 2) * cur.stride; }
+
+void byte_engine::read_row(const int i, uint8_t *dst) const {
+  memcpy(dst, grid_row(cur, i), cur.cols);
+}
+
+void byte_engine::read_cells(const int i, const int j, const int n,
+                             uint8_t *dst) const {
+  memcpy(dst, grid_row(cur, i) + j, n);
+}
+
+void byte_engine::write_row(const int i, const uint8_t *src) {
+  memcpy(grid_row(cur, i), src, cur.cols);
+  // only touched once stepped, so fresh engines can be written concurrently
+  if (!cur_live.live.empty())
+    cur_live.live.clear();
+  if (counted)
+    counted = false;
+}
+
+bool byte_engine::active(const int i, const int j, const int n) const {
+  return activity_span(cur_live, i, j, j + n - 1);
+}
+
+bool byte_engine::census(population &p) const {
+  if (counted)
+    p = cur_census;
+
+  return counted;
+}
+
+temporal_engine::temporal_engine(const int rows, const int cols,
+                                 const int depth)
+  : byte_engine(rows, cols), depth(depth) {}
+
+void temporal_engine::advance(const int n) {
+  for (int left = n; left > 0; left -= depth) {
+    if (left == 1) {
+      step();
+      break;
+    }
+
+    // the activity maps say nothing about generations skipped over
+    brain_blocked(cur, next, std::min(left, depth), scratch);
+    std::swap(cur, next);
+    cur_live.live.clear();
+    next_live.live.clear();
+    counted = false;
+  }
+}
+
+size_t hash_key_hash::operator()(const hash_key &k) const {
+  return random_word((uint64_t)k[0] << 32 | k[1], (uint64_t)k[2] << 32 | k[3]);
+}
+
+hashlife_engine::hashlife_engine(const int rows, const int cols,
+                                 const size_t budget)
+  : height(rows), width(cols), level(3), root(0), budget(budget) {
+  // the grid fills the top left of the root, walls the rest
+  while (1 << level < std::max(rows, cols))
+    level += 1;
+
+  canonicalize();
+  root = blank(level, 0, 0);
+}
+
+void hashlife_engine::step() { advance(1); }
+
+void hashlife_engine::sweep() {
+  // the next generation is remembered, so stepping to it is free afterwards
+  jump(0);
+}
+
+void hashlife_engine::advance(const int n) {
+  // the largest jumps first, each as large as the root allows
+  for (int left = n; left > 0;) {
+    int j = 0;
+
+    while (j + 1 < level && 2 << j <= left)
+      j += 1;
+    root = jump(j);
+    left -= 1 << j;
+    collect();
+  }
+}
+
+void hashlife_engine::read_row(const int i, uint8_t *dst) const {
+  fill_row(root, level, i, 0, dst);
+}
+
+void hashlife_engine::write_row(const int i, const uint8_t *src) {
+  std::lock_guard<std::mutex> hold(lock);
+
+  // the nodes replaced along the way are dropped once the budget is spent
+  root = put_row(root, level, i, 0, src);
+  collect();
+}
+
+size_t hashlife_engine::footprint() const {
+  return nodes.size() * HASH_NODE_BYTES + results.size() * HASH_RESULT_BYTES;
+}
+
+bool hashlife_engine::active(const int i, const int j, const int n) const {
+  return n > 0 && lit(root, level, i, j, n);
+}
+
+bool hashlife_engine::census(population &p) const {
+  // the hash of a cell depends on its position, which shared nodes do not have
+  if (args.on_cycle != CYCLE_IGNORE)
+    return false;
+
+  p = nodes[root].census;
+
+  return true;
+}
+
+void hashlife_engine::canonicalize() {
+  empty.assign(level + 1, CELL_OFF);
+  walls.assign(level + 1, HASH_WALL);
+
+  // the leaves are the cells, so their ids are their states
+  if (nodes.empty())
+    for (uint32_t s = 0; s <= HASH_WALL; s += 1) {
+      population p = EMPTY_POPULATION;
+
+      if (s == CELL_ON || s == CELL_DYING)
+        p = {s == CELL_ON, s == CELL_DYING, 0, 0, 0, 0, 0};
+      nodes.push_back({{s, s, s, s}, 0, p});
+    }
+
+  for (int k = 1; k <= level; k += 1) {
+    empty[k] = join(empty[k - 1], empty[k - 1], empty[k - 1], empty[k - 1]);
+    walls[k] = join(walls[k - 1], walls[k - 1], walls[k - 1], walls[k - 1]);
+  }
+}
+
+uint32_t hashlife_engine::join(const uint32_t nw, const uint32_t ne,
+                               const uint32_t sw, const uint32_t se) {
+  const hash_key key = {nw, ne, sw, se};
+  const uint32_t level = nodes[nw].level + 1;
+  const int half = 1 << level >> 1;
+  population p = EMPTY_POPULATION;
+  auto found = index.find(key);
+
+  if (found != index.end())
+    return found->second;
+
+  // the quadrants' boxes moved to where the quadrants are in the square
+  for (int q = 0; q < 4; q += 1) {
+    const population &c = nodes[key[q]].census;
+    const int y = q / 2 * half, x = q % 2 * half;
+
+    if (c.bottom < 0)
+      continue;
+    p.on += c.on;
+    p.dying += c.dying;
+    p.top = std::min(p.top, y + c.top);
+    p.left = std::min(p.left, x + c.left);
+    p.bottom = std::max(p.bottom, y + c.bottom);
+    p.right = std::max(p.right, x + c.right);
+  }
+
+  nodes.push_back({{nw, ne, sw, se}, level, p});
+  index.emplace(key, nodes.size() - 1);
+
+  return nodes.size() - 1;
+}
+
+uint32_t hashlife_engine::center(const uint32_t id) {
+  const hash_node n = nodes[id];
+
+  return join(nodes[n.child[0]].child[3], nodes[n.child[1]].child[2],
+              nodes[n.child[2]].child[1], nodes[n.child[3]].child[0]);
+}
+
+uint32_t hashlife_engine::across(const uint32_t w, const uint32_t e) {
+  const hash_node a = nodes[w], b = nodes[e];
+
+  return join(a.child[1], b.child[0], a.child[3], b.child[2]);
+}
+
+uint32_t hashlife_engine::down(const uint32_t n, const uint32_t s) {
+  const hash_node a = nodes[n], b = nodes[s];
+
+  return join(a.child[2], a.child[3], b.child[0], b.child[1]);
+}
+
+uint32_t hashlife_engine::base(const uint32_t id) {
+  uint32_t cells[4][4], next[2][2];
+
+  for (int r = 0; r < 4; r += 1)
+    for (int c = 0; c < 4; c += 1)
+      cells[r][c] =
+        nodes[nodes[id].child[r / 2 * 2 + c / 2]].child[r % 2 * 2 + c % 2];
+
+  // as brain_row_scalar(), walls staying walls and never counting as on
+  for (int r = 1; r < 3; r += 1)
+    for (int c = 1; c < 3; c += 1) {
+      const uint32_t cell = cells[r][c];
+      int tot = 0;
+
+      for (int k = -1; k < 2; k += 1)
+        for (int l = -1; l < 2; l += 1)
+          tot += cells[r + k][c + l] == CELL_ON;
+
+      next[r - 1][c - 1] = cell == HASH_WALL  ? HASH_WALL
+                           : cell == CELL_ON  ? CELL_DYING
+                           : cell == CELL_OFF && tot == 2 ? CELL_ON
+                                                          : CELL_OFF;
+    }
+
+  return join(next[0][0], next[0][1], next[1][0], next[1][1]);
+}
+
+uint32_t hashlife_engine::result(const uint32_t id, const int j) {
+  const uint64_t key = (uint64_t)id << 8 | j;
+  const int k = nodes[id].level;
+  auto found = results.find(key);
+  uint32_t sub[3][3], r;
+
+  if (found != results.end())
+    return found->second;
+
+  if (k == 2) {
+    r = base(id);
+  } else {
+    const hash_node n = nodes[id];
+    // the nine overlapping quadrant-sized squares of the node
+    const uint32_t squares[3][3] = {
+      {n.child[0], across(n.child[0], n.child[1]), n.child[1]},
+      {down(n.child[0], n.child[2]), center(id), down(n.child[1], n.child[3])},
+      {n.child[2], across(n.child[2], n.child[3]), n.child[3]},
+    };
+    // a full jump spends half its generations on each of the two stages
+    const bool full = j == k - 2;
+    const int later = full ? k - 3 : j;
+
+    for (int y = 0; y < 3; y += 1)
+      for (int x = 0; x < 3; x += 1)
+        sub[y][x] = full ? result(squares[y][x], k - 3)
+                         : center(squares[y][x]);
+
+    const uint32_t nw = join(sub[0][0], sub[0][1], sub[1][0], sub[1][1]);
+    const uint32_t ne = join(sub[0][1], sub[0][2], sub[1][1], sub[1][2]);
+    const uint32_t sw = join(sub[1][0], sub[1][1], sub[2][0], sub[2][1]);
+    const uint32_t se = join(sub[1][1], sub[1][2], sub[2][1], sub[2][2]);
+
+    r = join(result(nw, later), result(ne, later), result(sw, later),
+             result(se, later));
+  }
+
+  results.emplace(key, r);
+
+  return r;
+}
+
+uint32_t hashlife_engine::jump(const int j) {
+  const hash_node n = nodes[root];
+  const uint32_t w = walls[level - 1];
+
+  // walls all around keep the root from seeing past the edges of the grid
+  return result(
+    join(join(w, w, w, n.child[0]), join(w, w, n.child[1], w),
+         join(w, n.child[2], w, w), join(n.child[3], w, w, w)),
+    j
+  );
+}
+
+uint32_t hashlife_engine::blank(const int k, const int y, const int x) {
+  const int half = 1 << k >> 1;
+
+  if (y >= height || x >= width)
+    return walls[k];
+  if (y + (1 << k) <= height && x + (1 << k) <= width)
+    return empty[k];
+
+  return join(blank(k - 1, y, x), blank(k - 1, y, x + half),
+              blank(k - 1, y + half, x), blank(k - 1, y + half, x + half));
+}
+
+uint32_t hashlife_engine::put_row(const uint32_t id, const int k, const int y,
+                                  const int x, const uint8_t *src) {
+  const int half = 1 << k >> 1;
+
+  if (x >= width)
+    return id;
+  if (k == 0)
+    return src[x];
+  // off cells leave squares with every cell off as they are
+  if (id == empty[k] && !cells_any(src + x, std::min(1 << k, width - x)))
+    return id;
+
+  const hash_node n = nodes[id];
+  const int quadrant = y < half ? 0 : 2;
+  uint32_t child[4] = {n.child[0], n.child[1], n.child[2], n.child[3]};
+
+  child[quadrant] = put_row(child[quadrant], k - 1, y % half, x, src);
+  child[quadrant + 1] =
+    put_row(child[quadrant + 1], k - 1, y % half, x + half, src);
+
+  return join(child[0], child[1], child[2], child[3]);
+}
+
+bool hashlife_engine::lit(const uint32_t id, const int k, const int y,
+                          const int j, const int n) const {
+  const population &c = nodes[id].census;
+  const int half = 1 << k >> 1;
+
+  // nothing but off cells outside the box of the square
+  if (y < c.top || y > c.bottom || j + n - 1 < c.left || j > c.right)
+    return false;
+  if (k == 0)
+    return true;
+
+  const hash_node &node = nodes[id];
+  const int quadrant = y < half ? 0 : 2;
+
+  if (j < half &&
+      lit(node.child[quadrant], k - 1, y % half, j, std::min(n, half - j)))
+    return true;
+
+  return j + n > half &&
+         lit(node.child[quadrant + 1], k - 1, y % half, std::max(j - half, 0),
+             j + n - std::max(j, half));
+}
+
+void hashlife_engine::fill_row(const uint32_t id, const int k, const int y,
+                               const int x, uint8_t *dst) const {
+  const int half = 1 << k >> 1;
+
+  if (x >= width)
+    return;
+  if (id == empty[k] || id == walls[k]) {
+    memset(dst + x, CELL_OFF, std::min(1 << k, width - x));
+    return;
+  }
+  if (k == 0) {
+    dst[x] = id;
+    return;
+  }
+
+  const hash_node &n = nodes[id];
+  const int quadrant = y < half ? 0 : 2;
+
+  fill_row(n.child[quadrant], k - 1, y % half, x, dst);
+  fill_row(n.child[quadrant + 1], k - 1, y % half, x + half, dst);
+}
+
+void hashlife_engine::collect() {
+  // checked on every jump, so nothing is allocated until the budget is spent
+  if (footprint() <= budget)
+    return;
+
+  std::vector<uint32_t> remap(nodes.size(), UINT32_MAX);
+  std::vector<hash_node> kept(nodes.begin(), nodes.begin() + HASH_WALL + 1);
+  std::unordered_map<uint64_t, uint32_t> memo;
+
+  // only the nodes of the current generation survive, renumbered so that
+  // children still come before their parents
+  for (uint32_t s = 0; s <= HASH_WALL; s += 1)
+    remap[s] = s;
+  index.clear();
+  root = keep(root, remap, kept);
+
+  // along with what is known of their future when it survived too
+  for (const std::pair<const uint64_t, uint32_t> &entry : results) {
+    const uint32_t id = entry.first >> 8;
+
+    if (remap[id] != UINT32_MAX && remap[entry.second] != UINT32_MAX)
+      memo.emplace((uint64_t)remap[id] << 8 | (entry.first & 0xff),
+                   remap[entry.second]);
+  }
+
+  nodes.swap(kept);
+  results.swap(memo);
+  canonicalize();
+}
+
+uint32_t hashlife_engine::keep(const uint32_t id, std::vector<uint32_t> &remap,
+                               std::vector<hash_node> &kept) {
+  hash_node n = nodes[id];
+
+  if (remap[id] != UINT32_MAX)
+    return remap[id];
+
+  for (int q = 0; q < 4; q += 1)
+    n.child[q] = keep(n.child[q], remap, kept);
+
+  kept.push_back(n);
+  remap[id] = kept.size() - 1;
+  index.emplace(hash_key{n.child[0], n.child[1], n.child[2], n.child[3]},
+                remap[id]);
+
+  return remap[id];
+}
+
+bitboard_engine::bitboard_engine(const int rows, const int cols) {
+  failed = !bitgrid_create(cur, rows, cols) | !bitgrid_create(next, rows, cols);
+}
+
+bitboard_engine::~bitboard_engine() {
+  bitgrid_destroy(cur);
+  bitgrid_destroy(next);
+}
+
+void bitboard_engine::step() {
+  sweep();
+  std::swap(cur, next);
+  std::swap(cur_live, next_live);
+}
+
+void bitboard_engine::sweep() {
+  const int tw = tile.cols ? tile_count(tile.cols, 64) : cur.words;
+
+  activity_layout(cur_live, cur.rows, cur.words, tile.rows, tw);
+  activity_layout(next_live, cur.rows, cur.words, tile.rows, tw);
+  bitbrain(cur, next, cur_live, next_live);
+}
+
+size_t bitboard_engine::footprint() const {
+  return 2 * (cur.rows + 2) * cur.stride * sizeof(uint64_t);
+}
+
+bool bitboard_engine::active(const int i, const int j, const int n) const {
+  return activity_span(cur_live, i, j / 64, (j + n - 1) / 64);
+}
+
+gpu_engine::gpu_engine(const int rows, const int cols) {
+  std::string log;
+
+  // both generations live on the device with a halo of off cells
+  cur = cv::UMat(rows + 2, cols + 2, CV_8UC1,
+                 cv::USAGE_ALLOCATE_DEVICE_MEMORY);
+  next = cv::UMat(rows + 2, cols + 2, CV_8UC1,
+                  cv::USAGE_ALLOCATE_DEVICE_MEMORY);
+  cur.setTo(cv::Scalar::all(CELL_OFF));
+  next.setTo(cv::Scalar::all(CELL_OFF));
+  host = cv::Mat::zeros(rows, cols, CV_8UC1);
+  host_stale = false;
+  device_stale = false;
+
+  kernel = cv::ocl::Kernel(
+    "brain_step", cv::ocl::ProgramSource(BRAIN_OPENCL),
+    cv::format("-D CELL_OFF=%d -D CELL_ON=%d -D CELL_DYING=%d", CELL_OFF,
+               CELL_ON, CELL_DYING),
+    &log
+  );
+  if (kernel.empty()) {
+    fprintf(stderr, "unable to build OpenCL kernel: %s\n", log.c_str());
+    failed = true;
+  }
+}
+
+void gpu_engine::step() {
+  sweep(false);
+  std::swap(cur, next);
+  host_stale = true;
+}
+
+void gpu_engine::sweep() { sweep(true); }
+
+void gpu_engine::sweep(const bool sync) {
+  size_t global[2] = {(size_t)host.cols, (size_t)host.rows};
+
+  upload();
+  kernel.args(
+    cv::ocl::KernelArg::ReadOnlyNoSize(cur),
+    cv::ocl::KernelArg::WriteOnlyNoSize(next), host.rows, host.cols
+  );
+  if (!kernel.run(2, global, NULL, sync)) {
+    fprintf(stderr, "unable to run OpenCL kernel\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void gpu_engine::read_row(const int i, uint8_t *dst) const {
+  download();
+  memcpy(dst, host.ptr(i), host.cols);
+}
+
+void gpu_engine::write_row(const int i, const uint8_t *src) {
+  download();
+  memcpy(host.ptr(i), src, host.cols);
+  device_stale = true;
+}
+
+bool gpu_engine::read_frame(cv::Mat &cells) const {
+  if (device_stale)
+    host.copyTo(cells);
+  else
+    cur(cv::Rect(1, 1, host.cols, host.rows)).copyTo(cells);
+
+  return true;
+}
+
+size_t gpu_engine::footprint() const { return cur.total(); }
+
+void gpu_engine::download() const {
+  if (!host_stale)
+    return;
+
+  std::lock_guard<std::mutex> guard(lock);
+  if (host_stale) {
+    cur(cv::Rect(1, 1, host.cols, host.rows)).copyTo(host);
+    host_stale = false;
+  }
+}
+
+void gpu_engine::upload() {
+  if (!device_stale)
+    return;
+
+  cv::UMat interior = cur(cv::Rect(1, 1, host.cols, host.rows));
+  host.copyTo(interior);
+  device_stale = false;
+}
+
+void bitboard_engine::read_row(const int i, uint8_t *dst) const {
+  const uint64_t *on = cur.on + bitgrid_row(cur, i);
+  const uint64_t *dying = cur.dying + bitgrid_row(cur, i);
+
+  for (int j = 0; j < cur.cols; j += 1)
+    dst[j] = (on[j / 64] >> j % 64 & 1) * CELL_ON +
+             (dying[j / 64] >> j % 64 & 1) * CELL_DYING;
+}
+
+void bitboard_engine::read_cells(const int i, const int j0, const int n,
+                                 uint8_t *dst) const {
+  const uint64_t *on = cur.on + bitgrid_row(cur, i);
+  const uint64_t *dying = cur.dying + bitgrid_row(cur, i);
+
+  for (int j = j0; j < j0 + n; j += 1)
+    dst[j - j0] = (on[j / 64] >> j % 64 & 1) * CELL_ON +
+                  (dying[j / 64] >> j % 64 & 1) * CELL_DYING;
+}
+
+void bitboard_engine::write_row(const int i, const uint8_t *src) {
+  uint64_t *on = cur.on + bitgrid_row(cur, i);
+  uint64_t *dying = cur.dying + bitgrid_row(cur, i);
+
+  memset(on, 0, cur.words * sizeof(uint64_t));
+  memset(dying, 0, cur.words * sizeof(uint64_t));
+
+  for (int j = 0; j < cur.cols; j += 1) {
+    on[j / 64] |= (uint64_t)(src[j] == CELL_ON) << j % 64;
+    dying[j / 64] |= (uint64_t)(src[j] == CELL_DYING) << j % 64;
+  }
+
+  // only touched once stepped, so fresh engines can be written concurrently
+  if (!cur_live.live.empty())
+    cur_live.live.clear();
+}
+
+/**
+ * @brief Create a simulation engine with all cells turned off.
+ *
+ * @param type Engine to create.
+ * @param rows Number of rows in the grid.
+ * @param cols Number of columns in the grid.
+ * @return engine* New engine (release with delete), or NULL if it could not be
+ * set up (reported on stderr).
+ */
+engine *engine_create(const engine_type type, const int rows, const int cols) {
+  engine *e;
+
+  if (type == ENGINE_BITBOARD)
+    e = new bitboard_engine(rows, cols);
+  else if (type == ENGINE_OPENCL)
+    e = new gpu_engine(rows, cols);
+  else if (type == ENGINE_TEMPORAL)
+    e = new temporal_engine(rows, cols, args.temporal_depth);
+  else if (type == ENGINE_HASHLIFE)
+    e = new hashlife_engine(rows, cols, (size_t)args.hash_memory << 20);
+  else
+    e = new byte_engine(rows, cols);
+
+  if (e->failed) {
+    delete e;
+    return NULL;
+  }
+
+  return e;
+}
+
+/**
+ * @brief Check whether any of a run of cells is not off.
+ *
+ * @param cells Cells to check.
+ * @param n Number of cells.
+ * @return bool Whether any cell is on or dying.
+ */
+static inline bool cells_any(const uint8_t *cells, const int n) {
+  uint8_t any = CELL_OFF;
+
+  for (int j = 0; j < n; j += 1)
+    any |= cells[j];
+
+  return any != CELL_OFF;
+}
+
+/**
+ * @brief Count the cells of a run of a row into a population.
+ *
+ * @param cells Cells to count.
+ * @param n Number of cells.
+ * @param i Row of the cells in the grid.
+ * @param j Column of the first cell in the grid.
+ * @param p Population the cells are added to.
+ * @return bool Whether any cell is on or dying.
+ */
+static inline bool census_row(const uint8_t *cells, const int n, const int i,
+                              const int j, population &p) {
+  uint64_t on = 0, dying = 0;
+  int first = 0, last = n - 1;
+
+  for (int k = 0; k < n; k += 1) {
+    on += cells[k] == CELL_ON;
+    dying += cells[k] > CELL_ON;
+  }
+
+  if (on + dying == 0)
+    return false;
+
+  // the box only needs the outermost cells that are not off
+  while (cells[first] == CELL_OFF)
+    first += 1;
+  while (cells[last] == CELL_OFF)
+    last -= 1;
+
+  p.on += on;
+  p.dying += dying;
+  p.top = std::min(p.top, i);
+  p.bottom = std::max(p.bottom, i);
+  p.left = std::min(p.left, j + first);
+  p.right = std::max(p.right, j + last);
+
+  // each cell's hash only depends on where it is, however the row is split
+  if (args.on_cycle != CYCLE_IGNORE)
+    for (int k = first; k <= last; k += 1)
+      if (cells[k] != CELL_OFF)
+        p.hash += random_word(cells[k], (uint64_t)i << 32 | (j + k));
+
+  return true;
+}
+
+/**
+ * @brief Add a population counted over part of a grid to another one.
+ *
+ * @param into Population receiving the counts.
+ * @param p Population to add.
+ */
+static void census_merge(population &into, const population &p) {
+  into.on += p.on;
+  into.dying += p.dying;
+  into.top = std::min(into.top, p.top);
+  into.left = std::min(into.left, p.left);
+  into.bottom = std::max(into.bottom, p.bottom);
+  into.right = std::max(into.right, p.right);
+  into.hash += p.hash;
+}
+
+/**
+ * @brief Count the current generation of an engine row by row.
+ *
+ * Used by the engines that do not count their generations while stepping.
+ *
+ * @param e Engine holding the generation to count.
+ * @param p Receives the population of the generation.
+ */
+static void census_scan(const engine &e, population &p) {
+  p = EMPTY_POPULATION;
+
+#pragma omp parallel
+  {
+    std::vector<uint8_t> row(e.cols());
+    population local = EMPTY_POPULATION;
+
+#pragma omp for nowait
+    for (int i = 0; i < e.rows(); i += 1)
+      if (e.active(i, 0, e.cols())) {
+        e.read_row(i, row.data());
+        census_row(row.data(), e.cols(), i, 0, local);
+      }
+
+#pragma omp critical
+    census_merge(p, local);
+  }
+}
+
+/**
+ * @brief Count the current generation of an engine, unless it already was.
+ *
+ * @param e Engine holding the generation to count.
+ * @param p Receives the population of the generation.
+ */
+void census_take(const engine &e, population &p) {
+  if (!e.census(p))
+    census_scan(e, p);
+}
+
+/**
+ * @brief Copy the current generation of an engine into a frame.
+ *
+ * Frames hold one cell state per pixel. Row segments the engine reports as
+ * inactive are only cleared if the frame does not already show them off.
+ *
+ * @param e Engine holding the generation to copy.
+ * @param slot Frame (CV_8UC1, same size as the grid) receiving the cells.
+ */
+void colorize(const engine &e, frame_slot &slot) {
+  TRACE_SPAN("colorize");
+  if (view.cropped)
+    return colorize_view(e, slot);
+
+  cv::Mat &frame = slot.frame;
+  const int width = tile.cols ? std::min(tile.cols, frame.cols) : frame.cols;
+  const int nc = tile_count(frame.cols, width);
+
+  // engines that hand over whole frames leave nothing known to be blank
+  if (e.read_frame(frame)) {
+    slot.width = 0;
+    return;
+  }
+
+  if (slot.width != width) {
+    slot.width = width;
+    slot.blank.assign((size_t)frame.rows * nc, false);
+  }
+
+#pragma omp parallel for
+  for (int i = 0; i < frame.rows; i += 1) {
+    uint8_t *dst = frame.ptr<uint8_t>(i);
+    uint8_t *blank = &slot.blank[(size_t)i * nc];
+    bool any = false;
+
+    for (int c = 0; c < nc && !any; c += 1)
+      any = e.active(i, c * width, std::min(width, frame.cols - c * width));
+
+    // the whole row is copied if any part of it is active
+    if (any)
+      e.read_row(i, dst);
+
+    for (int c = 0; c < nc; c += 1) {
+      const int j = c * width, n = std::min(width, frame.cols - j);
+
+      if (any)
+        blank[c] = !e.active(i, j, n);
+      else if (!blank[c]) {
+        memset(dst + j, CELL_OFF, n);
+        blank[c] = true;
+      }
+    }
+  }
+}
+
+/**
+ * @brief Copy the viewport of an engine's current generation into a frame.
+ *
+ * Only the rows of the viewport that may hold cells that are not off are read
+ * from the engine. With a scale, the cells of each state are first counted
+ * down every column of a row of squares, then the counts of the columns of
+ * each square are added up, so both passes run along contiguous rows.
+ *
+ * @param e Engine holding the generation to copy.
+ * @param slot Frame (CV_8UC1, view.height by view.width) receiving the pixels.
+ */
+static void colorize_view(const engine &e, frame_slot &slot) {
+  cv::Mat &frame = slot.frame;
+  const int s = view.scale, cols = view.cols;
+  const bool density = view.mode == SCALE_DENSITY;
+  // states counted down the columns (the cells not off, for a density)
+  const int counted = density ? 1 : cell_states;
+
+#pragma omp parallel
+  {
+    std::vector<uint8_t> cells(cols);
+    std::vector<uint16_t> counts((size_t)counted * cols);
+
+#pragma omp for
+    for (int r = 0; r < frame.rows; r += 1) {
+      const int i0 = view.top + r * s;
+      const int i1 = std::min(i0 + s, view.top + view.rows);
+      uint8_t *dst = frame.ptr<uint8_t>(r);
+      bool any = false;
+
+      if (s == 1) {
+        if (e.active(i0, view.left, cols))
+          e.read_cells(i0, view.left, cols, dst);
+        else
+          memset(dst, CELL_OFF, cols);
+        continue;
+      }
+
+      // the off cells of a majority are whatever the other states leave
+      std::fill(counts.begin(), counts.end(), 0);
+      for (int i = i0; i < i1; i += 1) {
+        if (!e.active(i, view.left, cols))
+          continue;
+        e.read_cells(i, view.left, cols, cells.data());
+        any = true;
+
+        if (density)
+          for (int j = 0; j < cols; j += 1)
+            counts[j] += cells[j] != CELL_OFF;
+        else
+          for (int k = CELL_ON; k < counted; k += 1) {
+            uint16_t *count = &counts[(size_t)k * cols];
+
+            for (int j = 0; j < cols; j += 1)
+              count[j] += cells[j] == k;
+          }
+      }
+
+      // squares of off cells look the same in either mode
+      if (!any) {
+        memset(dst, CELL_OFF, frame.cols);
+        continue;
+      }
+
+      for (int c = 0; c < frame.cols; c += 1) {
+        const int j0 = c * s, j1 = std::min(j0 + s, cols);
+        const uint64_t area = (uint64_t)(i1 - i0) * (j1 - j0);
+        uint64_t sum = 0, best = 0;
+
+        if (density) {
+          for (int j = j0; j < j1; j += 1)
+            sum += counts[j];
+          dst[c] = (sum * (PALETTE_ENTRIES - 1) + area / 2) / area;
+          continue;
+        }
+
+        dst[c] = CELL_OFF;
+        for (int k = CELL_ON; k < counted; k += 1) {
+          uint64_t n = 0;
+
+          for (int j = j0; j < j1; j += 1)
+            n += counts[(size_t)k * cols + j];
+          sum += n;
+          if (n >= best) {
+            best = n;
+            dst[c] = k;
+          }
+        }
+        if (area - sum > best)
+          dst[c] = CELL_OFF;
+      }
+    }
+  }
+}
+
+/**
+ * @brief Pack a row of cell states at a few bits per cell.
+ *
+ * @param cells Row of cell states.
+ * @param packed Receives tile_count(cols, 8 / bits) bytes.
+ * @param cols Number of cells in the row.
+ * @param bits Bits per cell (CHECKPOINT_BITS or CHECKPOINT_WIDE_BITS).
+ */
+void pack_row(const uint8_t *__restrict__ cells, uint8_t *__restrict__ packed,
+              const int cols, const int bits) {
+  const int per_byte = 8 / bits;
+
+  for (int j = 0; j < cols; j += per_byte) {
+    uint8_t byte = 0;
+
+    for (int k = 0; k < per_byte && j + k < cols; k += 1)
+      byte |= cells[j + k] << (bits * k);
+    packed[j / per_byte] = byte;
+  }
+}
+
+/**
+ * @brief Run-length encode the bytes of a packed grid that changed.
+ *
+ * Runs of changed bytes are only ended by two unchanged bytes in a row, since
+ * a single one costs no more to repeat than to skip with a new pair.
+ *
+ * @param cur Packed grid to encode.
+ * @param prev Packed grid before it (NULL to encode a key frame).
+ * @param n Bytes in each grid.
+ * @param out Receives the encoded pairs of counts and changed bytes.
+ */
+static void delta_encode(const uint8_t *__restrict__ cur,
+                         const uint8_t *__restrict__ prev, const size_t n,
+                         std::vector<uint8_t> &out) {
+  auto change = [&](const size_t k) -> uint8_t {
+    return prev ? cur[k] ^ prev[k] : cur[k];
+  };
+
+  for (size_t k = 0; k < n;) {
+    size_t same = k, end;
+
+    while (same < n && change(same) == 0)
+      same += 1;
+    for (end = same; end < n; end += 1)
+      if (change(end) == 0 && (end + 1 == n || change(end + 1) == 0))
+        break;
+
+    varint_put(out, same - k);
+    varint_put(out, end - same);
+    for (k = same; k < end; k += 1)
+      out.push_back(change(k));
+  }
+}
+
+/**
+ * @brief Append a count as a little-endian base 128 varint.
+ *
+ * @param out Bytes receiving the varint.
+ * @param value Count to append.
+ */
+static void varint_put(std::vector<uint8_t> &out, uint64_t value) {
+  for (; value >= 0x80; value >>= 7)
+    out.push_back(value | 0x80);
+  out.push_back(value);
+}
+
+#ifdef USE_TRACE
+trace_span::trace_span(const char *name, const bool parallel) {
+  event.name = args.trace ? name : NULL;
+  if (event.name == NULL)
+    return;
+
+  event.tid = syscall(SYS_gettid);
+  event.region = parallel ? trace_region.load() : 0;
+  trace_read(event.counts);
+  event.start = seconds();
+}
+
+trace_span::~trace_span() {
+  uint64_t counts[TRACE_COUNTERS];
+
+  if (event.name == NULL)
+    return;
+
+  event.end = seconds();
+  trace_read(counts);
+  for (int k = 0; k < TRACE_COUNTERS; k += 1)
+    event.counts[k] = counts[k] - event.counts[k];
+
+  std::lock_guard<std::mutex> guard(trace_lock);
+  trace_events.push_back(event);
+}
+
+/**
+ * @brief Read the hardware counters of the calling thread.
+ *
+ * The counters of each thread are opened the first time it reads them. Ones
+ * the kernel does not allow (or the machine lacks) always read as zero.
+ *
+ * @param counts Receives TRACE_COUNTERS counts.
+ */
+static void trace_read(uint64_t *counts) {
+  static const uint64_t configs[TRACE_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES
+  };
+  thread_local int fds[TRACE_COUNTERS] = {};
+  thread_local bool opened = false;
+
+  if (!opened) {
+    struct perf_event_attr attr = {};
+
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    for (int k = 0; k < TRACE_COUNTERS; k += 1) {
+      attr.config = configs[k];
+      fds[k] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    opened = true;
+  }
+
+  for (int k = 0; k < TRACE_COUNTERS; k += 1)
+    if (fds[k] < 0 || read(fds[k], &counts[k], sizeof(*counts)) !=
+                        sizeof(*counts))
+      counts[k] = 0;
+}
+#endif
+
+/**
+ * @brief Map zeroed, untouched memory.
+ *
+ * With --huge-pages the length is rounded up to whole huge pages, which are
+ * reserved ones if there are enough of them and transparent ones otherwise.
+ *
+ * @param bytes Length to map, receives the length mapped.
+ * @return void* Start of the mapping (page aligned), or NULL if the memory
+ * could not be mapped (reported on stderr).
+ */
+static void *map_pages(size_t &bytes) {
+  const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  void *mem = MAP_FAILED;
+
+  if (args.huge_pages) {
+    bytes = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+  }
+  if (mem == MAP_FAILED) {
+    mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (mem != MAP_FAILED && args.huge_pages)
+      madvise(mem, bytes, MADV_HUGEPAGE);
+  }
+  if (mem == MAP_FAILED) {
+    perror("unable to map memory");
+    return NULL;
+  }
+
+  return mem;
+}
+
+/**
+ * @brief Map zeroed memory for the planes of a grid.
+ *
+ * Rows are split statically between the threads and first touched by the
+ * thread that steps them (as brain() splits its bands), so on NUMA machines
+ * their pages land on the node of that thread rather than of the main one.
+ *
+ * @param rows Number of rows in each plane (halo rows included).
+ * @param stride Bytes between the start of consecutive rows.
+ * @param planes Number of planes stored one after the other.
+ * @param bytes Receives the length of the mapping.
+ * @return void* Start of the mapping (page aligned), or NULL if it failed.
+ */
+static void *grid_map(const int rows, const size_t stride, const int planes,
+                      size_t &bytes) {
+  const size_t plane = rows * stride;
+  uint8_t *mem;
+
+  bytes = planes * plane;
+  mem = (uint8_t *)map_pages(bytes);
+  if (mem == NULL)
+    return NULL;
+
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < rows; i += 1)
+    for (int p = 0; p < planes; p += 1)
+      memset(mem + p * plane + i * stride, 0, stride);
+
+  return mem;
+}
+
+/**
+ * @brief Set the schedule of the calling thread's step loops from --schedule.
+ *
+ * The tile loops use schedule(runtime), except for the list of active tiles
+ * of brain() under the auto schedule, which is always handed out dynamically
+ * (the other engines' loops then run dynamically too).
+ */
+void schedule_apply(void) {
+#ifdef _OPENMP
+  static const omp_sched_t kinds[] = {
+    omp_sched_static, omp_sched_dynamic, omp_sched_guided, omp_sched_dynamic
+  };
+
+  omp_set_schedule(kinds[args.schedule], args.chunk);
+#endif
+}
+
+/**
+ * @brief Allocate a grid with all cells (including the halo) turned off.
+ *
+ * @param g Grid to initialize.
+ * @param rows Number of rows in the grid.
+ * @param cols Number of columns in the grid.
+ * @return bool Whether the grid could be mapped (failures are reported).
+ */
+bool grid_create(grid &g, const int rows, const int cols) {
+  // rows are padded so that each interior row starts on an aligned boundary
+  // and has at least one halo cell on either side
+  g.rows = rows;
+  g.cols = cols;
+  g.stride = GRID_ALIGN + (cols + GRID_ALIGN) / GRID_ALIGN * GRID_ALIGN;
+
+  // the mapping is zeroed, and so all CELL_OFF
+  g.mem = (uint8_t *)grid_map(rows + 2, g.stride, 1, g.bytes);
+  g.cells = g.mem ? g.mem + g.stride + GRID_ALIGN : NULL;
+
+  return g.mem != NULL;
+}
+
+/**
+ * @brief Release the memory held by a grid.
+ *
+ * @param g Grid to release.
+ */
+void grid_destroy(grid &g) {
+  if (g.mem)
+    munmap(g.mem, g.bytes);
+  g.mem = g.cells = NULL;
+}
+
+/**
+ * @brief Get a pointer to the first cell of a grid row.
+ *
+ * @param g Grid to index.
+ * @param i Row index (-1 and g.rows address the halo rows).
+ * @return uint8_t* Pointer to column 0 of row i.
+ */
+uint8_t *grid_row(const grid &g, const int i) {
+  return g.cells + (ptrdiff_t)i * g.stride;
+}
+
+/**
+ * @brief Carve a frame out of an arena.
+ *
+ * Rows are first touched in parallel, split between the threads as the loops
+ * colorizing the frame split them.
+ *
+ * The smallest frame given back that is large enough is reused first.
+ *
+ * @param a Arena holding the frame.
+ * @param rows Number of rows in the frame.
+ * @param cols Number of columns in the frame.
+ * @param channels Bytes per pixel.
+ * @return cv::Mat Header over the frame (valid until the arena is released),
+ * empty if no memory could be mapped for it (reported on stderr).
+ */
+cv::Mat arena_frame(frame_arena &a, const int rows, const int cols,
+                    const int channels) {
+  const size_t step = (size_t)tile_count(cols * channels, GRID_ALIGN) *
+                      GRID_ALIGN;
+  const size_t bytes = step * rows;
+  uint8_t *mem = NULL;
+
+  {
+    std::lock_guard<std::mutex> guard(a.lock);
+    size_t best = a.spare.size();
+
+    for (size_t k = 0; k < a.spare.size(); k += 1)
+      if (a.spare[k].second >= bytes &&
+          (best == a.spare.size() || a.spare[k].second < a.spare[best].second))
+        best = k;
+
+    if (best < a.spare.size()) {
+      mem = a.spare[best].first;
+      a.spare.erase(a.spare.begin() + best);
+    } else {
+      if (a.chunks.empty() || a.used + bytes > a.chunks.back().second) {
+        size_t length = std::max(bytes, (size_t)ARENA_CHUNK);
+        uint8_t *chunk = (uint8_t *)map_pages(length);
+
+        if (chunk == NULL)
+          return cv::Mat();
+        a.chunks.push_back({chunk, length});
+        a.used = 0;
+      }
+
+      mem = a.chunks.back().first + a.used;
+      a.used += bytes;
+      a.allocations += 1;
+    }
+  }
+
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < rows; i += 1)
+    memset(mem + i * step, 0, step);
+
+  return cv::Mat(rows, cols, CV_MAKETYPE(CV_8U, channels), mem, step);
+}
+
+/**
+ * @brief Give a frame back to its arena to be handed out again.
+ *
+ * @param a Arena the frame was carved from.
+ * @param frame Frame no longer in use.
+ */
+void arena_recycle(frame_arena &a, const cv::Mat &frame) {
+  std::lock_guard<std::mutex> guard(a.lock);
+
+  a.spare.push_back({frame.data, frame.step * frame.rows});
+}
+
+/**
+ * @brief Create the sink for an output format.
+ *
+ * @param format Format of the frames.
+ * @param path File receiving the frames ("-" for stdout).
+ * @param rows Number of rows in each frame.
+ * @param cols Number of columns in each frame.
+ * @param depth Number of frames in the ring feeding the sink.
+ * @return sink* New sink (release with delete), or NULL if it could not be
+ * opened (reported on stderr).
+ */
+sink *sink_create(const output_format format, const char *path, const int rows,
+                  const int cols, const int depth) {
+  sink *out;
+
+  // mapped frames come from the arena too
+  if (format == FORMAT_AVI)
+    out = new video_sink(path, rows, cols, palette_bgr[0].val, 3);
+  else if (format == FORMAT_AVI_GRAY)
+    out = new video_sink(path, rows, cols, palette_gray, 1);
+  else if (format == FORMAT_RGB24)
+    out = new raw_sink(path, rows, cols, palette_rgb[0].val, 3, depth);
+  else if (format == FORMAT_GRAY8)
+    out = new raw_sink(path, rows, cols, palette_gray, 1, depth);
+  else if (format == FORMAT_BBRAIN)
+    out = new recording_sink(path, rows, cols, args.keyframe_interval);
+  else if (format == FORMAT_NONE)
+    out = new null_sink();
+  else
+    out = new raw_sink(path, rows, cols, NULL, 1, depth);
+
+  if (out->failed) {
+    delete out;
+    return NULL;
+  }
+
+  return out;
+}
+
+sink::sink(const uint8_t *palette, const int channels, const int rows,
+           const int cols)
+  : palette(palette), channels(channels), current(0), failed(false) {
+  for (int k = 0; k < 2 && palette; k += 1) {
+    pixels[k] = arena_frame(pool, rows, cols, channels);
+    failed |= pixels[k].empty();
+  }
+}
+
+sink::~sink() {
+  for (int k = 0; k < 2 && palette; k += 1)
+    if (!pixels[k].empty())
+      arena_recycle(pool, pixels[k]);
+}
+
+const cv::Mat &sink::expand(const cv::Mat &cells) {
+  if (palette == NULL)
+    return cells;
+
+  // alternate between two frames so the previous one is left untouched
+  current ^= 1;
+  cv::Mat &dst = pixels[current];
+
+  for (int i = 0; i < cells.rows; i += 1)
+    palette_row(
+      cells.ptr<uint8_t>(i), dst.ptr<uint8_t>(i), cells.cols, palette, channels
+    );
+
+  return dst;
+}
+
+video_sink::video_sink(const char *path, const int rows, const int cols,
+                       const uint8_t *palette, const int channels)
+  : sink(palette, channels, rows, cols), size(cols, rows), encoder(0),
+    fd(-1) {
+  open(path);
+}
+
+video_sink::~video_sink() { finish(); }
+
+void video_sink::open(const char *path) {
+  const std::string dims = cv::format("%dx%d", size.width, size.height);
+  const std::string fps = cv::format("%d", args.fps);
+  std::vector<const char *> argv = {
+    "ffmpeg", "-v", "error", "-y", "-f", "rawvideo", "-pixel_format",
+    channels == 3 ? "bgr24" : "gray", "-video_size", dims.c_str(),
+    "-framerate", fps.c_str(), "-i", "-"
+  };
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attributes;
+  int pipe_fds[2];
+
+  finish();
+
+  // opening releases the video written before
+  if (strcmp(args.codec, CODEC_FFV1) == 0) {
+    video.open(
+      path, cv::VideoWriter::fourcc('F', 'F', 'V', '1'), args.fps, size,
+      channels == 3
+    );
+
+    if (!video.isOpened()) {
+      fprintf(stderr, "unable to open video stream: %s\n", path);
+      failed = true;
+    }
+    return;
+  }
+
+  codec_options(args.codec, argv);
+  argv.insert(argv.end(), {path, NULL});
+
+  // the encoders of other segments must not hold on to this pipe, or it
+  // never reaches its end
+  if (pipe2(pipe_fds, O_CLOEXEC) != 0) {
+    perror("unable to open encoder pipe");
+    failed = true;
+    return;
+  }
+
+  // the encoder gets a process group of its own, so a Ctrl-C (or a SIGTERM
+  // sent to our group) stops the simulation at a checkpoint while the encoder
+  // carries on with the frames queued until we close its pipe
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, pipe_fds[0], STDIN_FILENO);
+  posix_spawnattr_init(&attributes);
+  posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+  posix_spawnattr_setpgroup(&attributes, 0);
+  if (posix_spawnp(&encoder, "ffmpeg", &actions, &attributes,
+                   (char *const *)argv.data(), environ) != 0) {
+    fprintf(stderr, "unable to run ffmpeg for video stream: %s\n", path);
+    encoder = 0;
+    close(pipe_fds[1]);
+    failed = true;
+  }
+  posix_spawnattr_destroy(&attributes);
+  posix_spawn_file_actions_destroy(&actions);
+  close(pipe_fds[0]);
+  if (failed)
+    return;
+  fd = pipe_fds[1];
+
+  // an encoder that fails is reported rather than killing the program, and
+  // the pipe holds a whole frame where it may grow that much
+  signal(SIGPIPE, SIG_IGN);
+  fcntl(fd, F_SETPIPE_SZ,
+        (int)std::min((size_t)size.width * size.height * channels,
+                      (size_t)INT_MAX));
+}
+
+void video_sink::write(const cv::Mat &cells) {
+  if (failed)
+    return;
+  if (encoder)
+    failed = !write_frame(fd, expand(cells), iov, false);
+  else
+    video << expand(cells);
+}
+
+void video_sink::finish() {
+  int status;
+
+  if (encoder == 0)
+    return;
+
+  // the encoder finishes the video once it reads the end of its input
+  close(fd);
+  if (waitpid(encoder, &status, 0) < 0 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "ffmpeg could not encode the video with %s\n",
+            args.codec);
+    failed = true;
+  }
+  encoder = 0;
+}
+
+raw_sink::raw_sink(const char *path, const int rows, const int cols,
+                   const uint8_t *palette, const int channels, const int depth)
+  : sink(palette, channels, rows, cols) {
+  const size_t frame_bytes = (size_t)rows * cols * channels;
+  struct stat st;
+
+  if (strcmp(path, "-") == 0)
+    fd = STDOUT_FILENO;
+  else
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (fd < 0) {
+    perror("unable to open output");
+    failed = true;
+    splice = false;
+    return;
+  }
+
+  // Pages handed to vmsplice() stay referenced by the pipe until the reader
+  // consumes them, so a frame may only be reused once a later frame has been
+  // spliced after it, which must fill the pipe on its own. Mapped frames
+  // alternate between two buffers; cell frames are spliced straight from the
+  // ring, which then needs a spare slot to hold on to the earlier frame.
+  splice = fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode) &&
+           frame_bytes >= (size_t)fcntl(fd, F_GETPIPE_SZ) &&
+           (palette != NULL || depth > 1);
+}
+
+raw_sink::~raw_sink() {
+  struct pollfd reader = {.fd = fd, .events = 0, .revents = 0};
+  int queued;
+
+  // the pipe still references the last spliced frames, which must not be
+  // freed before they are read (or the reader goes away)
+  while (splice && ioctl(fd, FIONREAD, &queued) == 0 && queued > 0 &&
+         poll(&reader, 1, 1) == 0)
+    continue;
+
+  if (fd >= 0 && fd != STDOUT_FILENO)
+    close(fd);
+}
+
+void raw_sink::write(const cv::Mat &cells) {
+  if (!failed)
+    failed = !write_frame(fd, expand(cells), iov, splice);
+}
+
+/**
+ * @brief Write a frame to a file or a pipe.
+ *
+ * @param fd Destination of the frame.
+ * @param frame Frame to write.
+ * @param iov Receives the rows of the frame.
+ * @param splice Map the frame into the pipe with vmsplice() (no copy).
+ * @return bool Whether the whole frame was written (failures are reported).
+ */
+static bool write_frame(const int fd, const cv::Mat &frame,
+                        std::vector<struct iovec> &iov, const bool splice) {
+  const size_t bytes = frame.cols * frame.elemSize();
+
+  // rows are gathered straight from the frame (one vector if continuous)
+  iov.clear();
+  if (frame.isContinuous())
+    iov.push_back({(void *)frame.ptr(0), bytes * frame.rows});
+  else
+    for (int i = 0; i < frame.rows; i += 1)
+      iov.push_back({(void *)frame.ptr(i), bytes});
+
+  for (size_t k = 0; k < iov.size();) {
+    int cnt = std::min(iov.size() - k, (size_t)IOV_MAX);
+    ssize_t n = splice ? vmsplice(fd, &iov[k], cnt, 0)
+                       : writev(fd, &iov[k], cnt);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      perror("unable to write frame");
+      return false;
+    }
+
+    // skip the vectors written completely, then advance into the next one
+    for (; k < iov.size() && (size_t)n >= iov[k].iov_len; k += 1)
+      n -= iov[k].iov_len;
+    if (k < iov.size()) {
+      iov[k].iov_base = (uint8_t *)iov[k].iov_base + n;
+      iov[k].iov_len -= n;
+    }
+  }
+
+  return true;
+}
+
+int raw_sink::retained() const { return splice && palette == NULL ? 1 : 0; }
+
+recording_sink::recording_sink(const char *path, const int rows,
+                               const int cols, const int interval)
+  : sink(NULL, 1, rows, cols), interval(interval), written(0) {
+  recording_header header = {};
+
+  if (strcmp(path, "-") == 0)
+    fd = STDOUT_FILENO;
+  else
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (fd < 0) {
+    perror("unable to open output");
+    failed = true;
+  }
+
+  bits = cell_states > 4 ? CHECKPOINT_WIDE_BITS : CHECKPOINT_BITS;
+  stride = tile_count(cols, 8 / bits);
+  packed[0].resize(stride * rows);
+  packed[1].resize(stride * rows);
+  buffer.reserve(RECORDING_FLUSH_BYTES + packed[0].size());
+
+  memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+  header.version = RECORDING_VERSION;
+  header.rows = rows;
+  header.cols = cols;
+  header.bits = bits;
+  header.states = cell_states;
+  header.keyframe_interval = interval;
+  buffer.insert(
+    buffer.end(), (uint8_t *)&header, (uint8_t *)&header + sizeof(header)
+  );
+}
+
+recording_sink::~recording_sink() { finish(); }
+
+void recording_sink::finish() {
+  recording_trailer trailer;
+
+  if (fd < 0)
+    return;
+
+  // the index and trailer close the recording
+  trailer.frames = index.size();
+  trailer.index = written + buffer.size();
+  memcpy(trailer.magic, RECORDING_MAGIC, sizeof(trailer.magic));
+  buffer.insert(
+    buffer.end(), (uint8_t *)index.data(), (uint8_t *)index.data() +
+                                             index.size() * sizeof(uint64_t)
+  );
+  buffer.insert(
+    buffer.end(), (uint8_t *)&trailer, (uint8_t *)&trailer + sizeof(trailer)
+  );
+  flush();
+
+  if (fd != STDOUT_FILENO)
+    close(fd);
+  fd = -1;
+}
+
+void recording_sink::write(const cv::Mat &cells) {
+  const bool key = index.size() % interval == 0;
+
+  if (failed)
+    return;
+
+  for (int i = 0; i < cells.rows; i += 1)
+    pack_row(cells.ptr<uint8_t>(i), packed[0].data() + i * stride, cells.cols,
+             bits);
+
+  index.push_back(written + buffer.size());
+  delta_encode(
+    packed[0].data(), key ? NULL : packed[1].data(), packed[0].size(), buffer
+  );
+  std::swap(packed[0], packed[1]);
+
+  // written in large sequential chunks
+  if (buffer.size() >= RECORDING_FLUSH_BYTES)
+    flush();
+}
+
+void recording_sink::flush() {
+  // bytes after a failed write would only leave a hole in the recording
+  if (failed)
+    buffer.clear();
+
+  for (size_t k = 0; k < buffer.size();) {
+    ssize_t n = ::write(fd, buffer.data() + k, buffer.size() - k);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      perror("unable to write recording");
+      failed = true;
+      break;
+    }
+    k += n;
+  }
+
+  written += buffer.size();
+  buffer.clear();
+}
+
+/**
+ * @brief Read a monotonic clock.
+ *
+ * @return double Seconds since an arbitrary point in time.
+ */
+double seconds(void) {
+  return std::chrono::duration<double>(
+           std::chrono::steady_clock::now().time_since_epoch()
+  )
+    .count();
+}
+
+/**
+ * @brief Draw 64 random bits from a counter-based generator.
+ *
+ * Word n is the nth output of splitmix64 started at seed, so any word can be
+ * drawn without drawing the ones before it.
+ *
+ * @param seed Seed of the generator.
+ * @param n Index of the word.
+ * @return uint64_t Random bits.
+ */
+uint64_t random_word(const uint64_t seed, const uint64_t n) {
+  uint64_t z = seed + (n + 1) * SEED_GAMMA;
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+
+  return z ^ (z >> 31);
+}
+
+/**
+ * @brief Compute part of a row of a randomly seeded grid.
+ *
+ * Each row of the centred seed square takes its cells from its own run of
+ * random words, so any part of the grid can be seeded on its own (in parallel,
+ * or on another rank) and the result only depends on the seed.
+ *
+ * @param dst Receives n cells.
+ * @param i Row of the grid.
+ * @param j0 First column of the grid to compute.
+ * @param n Number of cells to compute.
+ * @param rows Number of rows in the grid.
+ * @param cols Number of columns in the grid.
+ * @param seed Seed of the random number generator.
+ */
+void seed_cells(uint8_t *dst, const int i, const int j0, const int n,
+                const int rows, const int cols, const uint64_t seed) {
+  const int size = std::min(rows, cols) * DEFAULT_SEED_AREA;
+  const int top = (rows - size) / 2, left = (cols - size) / 2;
+  const int words = tile_count(size, 64);
+  const int end = std::min(j0 + n, left + size);
+
+  memset(dst, CELL_OFF, n);
+  if (i < top || i >= top + size)
+    return;
+
+  // one draw covers 64 cells, a set bit turning the cell on
+  for (int j = std::max(j0, left); j < end;) {
+    const int w = (j - left) / 64;
+    const uint64_t bits = random_word(seed, (uint64_t)(i - top) * words + w);
+
+    for (; j < end && j < left + 64 * (w + 1); j += 1)
+      dst[j - j0] = bits >> (j - left) % 64 & 1 ? CELL_ON : CELL_OFF;
+  }
+}
+
+/**
+ * @brief Randomly seed a centred square of an engine's current generation.
+ *
+ * @param e Engine to seed (all cells off).
+ * @param seed Seed of the random number generator.
+ */
+void seed_random(engine &e, const uint64_t seed) {
+  const int rows = e.rows(), cols = e.cols();
+  const int size = std::min(rows, cols) * DEFAULT_SEED_AREA;
+
+#pragma omp parallel
+  {
+    std::vector<uint8_t> row(cols);
+
+#pragma omp for
+    for (int i = (rows - size) / 2; i < (rows + size) / 2; i += 1) {
+      seed_cells(row.data(), i, 0, cols, rows, cols, seed);
+      e.write_row(i, row.data());
+    }
+  }
+}
+
+/**
+ * @brief Count the blocks needed to cover a dimension.
+ *
+ * @param size Number of cells (or words) along the dimension.
+ * @param block Number of cells (or words) per block.
+ * @return int Number of blocks, the last one possibly partial.
+ */
+int tile_count(const int size, const int block) {
+  return (size + block - 1) / block;
+}
+
+/**
+ * @brief Find the position of a name in a list of option values.
+ *
+ * @param names Accepted option values.
+ * @param count Number of accepted option values.
+ * @param name Option value given on the command line.
+ * @return int Index of name within names, or -1 if it is not listed.
+ */
+int lookup_name(const char *const *names, const size_t count,
+                const char *name) {
+  for (size_t i = 0; i < count; i += 1)
+    if (strcmp(name, names[i]) == 0)
+      return i;
+
+  return -1;
+}
+
+//-----------------------------------------------------------------------------
+// LIBRARY FUNCTIONS (documented in brain.hpp)
+//-----------------------------------------------------------------------------
+
+int brain_setup(const brain_settings *settings) {
+  automaton_rule rule = RULES[0].rule;
+  int isa = SIMD_AUTO;
+
+  if (settings && settings->rule && !parse_rule(settings->rule, rule)) {
+    fprintf(stderr, "unknown rule: %s\n", settings->rule);
+    return -1;
+  }
+  if (settings && settings->simd) {
+    isa = lookup_name(
+      SIMD_NAMES, sizeof(SIMD_NAMES) / sizeof(*SIMD_NAMES), settings->simd
+    );
+    if (isa < 0 || !simd_supported((simd_isa)isa)) {
+      fprintf(stderr, "instruction set not supported: %s\n", settings->simd);
+      return -1;
+    }
+  }
+
+  arguments_default(args);
+  args.rule = rule;
+  args.simd = (simd_isa)isa;
+  rule_apply();
+
+#ifdef _OPENMP
+  if (settings && settings->threads > 0)
+    omp_set_num_threads(settings->threads);
+#endif
+  schedule_apply();
+
+  configured = true;
+  return 0;
+}
+
+brain_sim *brain_sim_create(const char *engine, const int rows,
+                            const int cols) {
+  int type = ENGINE_BYTE;
+  struct engine *e;
+
+  if (!configured)
+    brain_setup(NULL);
+
+  if (engine)
+    type = lookup_name(
+      ENGINE_NAMES, sizeof(ENGINE_NAMES) / sizeof(*ENGINE_NAMES), engine
+    );
+  if (type < 0) {
+    fprintf(stderr, "unknown engine: %s\n", engine);
+    return NULL;
+  }
+  if (type == ENGINE_OPENCL && !cv::ocl::haveOpenCL()) {
+    fprintf(stderr, "no OpenCL device available\n");
+    return NULL;
+  }
+  if (!rule_runs((engine_type)type, args.rule)) {
+    fprintf(stderr, "the %s engine only runs Brian's Brain\n", engine);
+    return NULL;
+  }
+  if (rows < 1 || cols < 1 || rows > MAX_GRID_SIZE || cols > MAX_GRID_SIZE) {
+    fprintf(stderr, "unsupported grid size: %dx%d\n", cols, rows);
+    return NULL;
+  }
+
+  // nothing thrown may cross into the library's user
+  try {
+    e = engine_create((engine_type)type, rows, cols);
+  } catch (const std::bad_alloc &) {
+    fprintf(stderr, "unable to allocate a %dx%d grid\n", cols, rows);
+    return NULL;
+  }
+
+  return e ? new brain_sim{e, 0} : NULL;
+}
+
+void brain_sim_destroy(brain_sim *sim) {
+  delete sim->e;
+  delete sim;
+}
+
+void brain_sim_seed(brain_sim *sim, const uint64_t seed) {
+  seed_random(*sim->e, seed);
+}
+
+void brain_sim_step(brain_sim *sim, const int n) {
+  sim->e->advance(n);
+  sim->generation += n;
+}
+
+uint64_t brain_sim_generation(const brain_sim *sim) {
+  return sim->generation;
+}
+
+void brain_sim_size(const brain_sim *sim, int *rows, int *cols) {
+  *rows = sim->e->rows();
+  *cols = sim->e->cols();
+}
+
+void brain_sim_read_row(const brain_sim *sim, const int i, uint8_t *dst) {
+  sim->e->read_row(i, dst);
+}
+
+void brain_sim_write_row(brain_sim *sim, const int i, const uint8_t *src) {
+  sim->e->write_row(i, src);
+}
+
+void brain_sim_census(const brain_sim *sim, brain_population *p) {
+  population counted;
+
+  census_take(*sim->e, counted);
+
+  p->on = counted.on;
+  p->dying = counted.dying;
+  p->top = counted.top;
+  p->left = counted.left;
+  p->bottom = counted.bottom;
+  p->right = counted.right;
+}
+
+brain_sink *brain_sink_open(const char *format, const char *path,
+                            const int rows, const int cols) {
+  int type = FORMAT_AVI;
+  brain_sink *out;
+
+  if (!configured)
+    brain_setup(NULL);
+
+  if (format)
+    type = lookup_name(
+      FORMAT_NAMES, sizeof(FORMAT_NAMES) / sizeof(*FORMAT_NAMES), format
+    );
+  if (type < 0) {
+    fprintf(stderr, "unknown frame format: %s\n", format);
+    return NULL;
+  }
+
+  out = new brain_sink;
+  out->out = sink_create((output_format)type, path, rows, cols, 1);
+  out->slot.frame = arena_frame(pool, rows, cols, 1);
+  out->slot.width = 0;
+
+  if (out->out == NULL || out->slot.frame.empty()) {
+    brain_sink_close(out);
+    return NULL;
+  }
+
+  return out;
+}
+
+brain_sink *brain_sink_callback(brain_frame_fn fn, void *user, const int rows,
+                                const int cols) {
+  brain_sink *out = new brain_sink;
+
+  out->out = new callback_sink(fn, user);
+  out->slot.frame = arena_frame(pool, rows, cols, 1);
+  out->slot.width = 0;
+
+  if (out->slot.frame.empty()) {
+    brain_sink_close(out);
+    return NULL;
+  }
+
+  return out;
+}
+
+int brain_sink_write(brain_sink *out, const brain_sim *sim) {
+  if (sim->e->rows() != out->slot.frame.rows ||
+      sim->e->cols() != out->slot.frame.cols)
+    return -1;
+
+  colorize(*sim->e, out->slot);
+  out->out->write(out->slot.frame);
+
+  return out->out->failed ? -1 : 0;
+}
+
+int brain_sink_close(brain_sink *out) {
+  int status = 0;
+
+  if (out->out) {
+    out->out->finish();
+    status = out->out->failed ? -1 : 0;
+  }
+
+  delete out->out;
+  if (!out->slot.frame.empty())
+    arena_recycle(pool, out->slot.frame);
+  delete out;
+
+  return status;
+}
@@ -0,0 +1,197 @@
+/**
+ * @file brain.hpp
+ * @author Mahyar Mirrashed (mirrashm@myumanitoba.ca)
+ * @brief Embed the Brian's Brain simulation in another program (libbrain).
+ * @version 0.2.2
+ * @date 2022-08-10
+ *
+ * @copyright Copyright (c) 2022 Mahyar Mirrashed
+ *
+ */
+
+#ifndef BRAIN_HPP
+#define BRAIN_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+// functions exported by libbrain.so (everything else stays hidden)
+#define BRAIN_API __attribute__((visibility("default")))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// states of the cells read from and written to a simulation, one byte each
+// (rules with more states count the refractory states on from BRAIN_DYING)
+#define BRAIN_OFF   0
+#define BRAIN_ON    1
+#define BRAIN_DYING 2
+
+// Settings shared by every simulation of the process, as given to the options
+// of the same names. Any field left 0 (or NULL) keeps the program's default.
+typedef struct {
+  const char *rule; // name or counts of the rule (--rule)
+  const char *simd; // instruction set of the kernels (--simd)
+  int threads;      // threads stepping a simulation (--threads)
+} brain_settings;
+
+// Population of a generation: the cells on and in a refractory state (all the
+// others being off), and the bounding box of the cells that are not off.
+typedef struct {
+  uint64_t on;
+  uint64_t dying;
+  int top, left;     // first row and column (INT_MAX if all cells are off)
+  int bottom, right; // last row and column (-1 if all cells are off)
+} brain_population;
+
+// grid of cells stepped by one of the engines (--engine)
+typedef struct brain_sim brain_sim;
+
+// destination of the frames of a simulation
+typedef struct brain_sink brain_sink;
+
+// Receives each frame written to a callback sink: rows rows of cols cell
+// states, stride bytes apart, only valid until the function returns.
+typedef void (*brain_frame_fn)(const uint8_t *cells, size_t stride, int rows,
+                               int cols, void *user);
+
+/**
+ * @brief Apply the settings shared by every simulation of the process.
+ *
+ * Must come before the first simulation is created (which otherwise applies
+ * the defaults), and not while one is being stepped.
+ *
+ * @param settings Settings to apply (NULL for the defaults).
+ * @return int 0, or -1 if a setting is not valid (reported on stderr).
+ */
+BRAIN_API int brain_setup(const brain_settings *settings);
+
+/**
+ * @brief Create a simulation with all cells turned off.
+ *
+ * @param engine Name of the engine (NULL for the byte engine).
+ * @param rows Number of rows in the grid.
+ * @param cols Number of columns in the grid.
+ * @return brain_sim* New simulation, or NULL if the engine is unknown, does
+ * not run the rule or could not be set up (reported on stderr).
+ */
+BRAIN_API brain_sim *brain_sim_create(const char *engine, int rows, int cols);
+
+/**
+ * @brief Release a simulation.
+ *
+ * @param sim Simulation to release.
+ */
+BRAIN_API void brain_sim_destroy(brain_sim *sim);
+
+/**
+ * @brief Randomly seed a centred square of the grid, as --seed does.
+ *
+ * @param sim Simulation to seed (all cells off).
+ * @param seed Seed of the random number generator.
+ */
+BRAIN_API void brain_sim_seed(brain_sim *sim, uint64_t seed);
+
+/**
+ * @brief Advance a simulation by n generations.
+ *
+ * Distinct simulations may be stepped from distinct threads at once.
+ *
+ * @param sim Simulation to advance.
+ * @param n Number of generations.
+ */
+BRAIN_API void brain_sim_step(brain_sim *sim, int n);
+
+/**
+ * @brief Number of generations a simulation was advanced by so far.
+ *
+ * @param sim Simulation to query.
+ * @return uint64_t Generation of the current grid.
+ */
+BRAIN_API uint64_t brain_sim_generation(const brain_sim *sim);
+
+/**
+ * @brief Size of the grid of a simulation.
+ *
+ * @param sim Simulation to query.
+ * @param rows Receives the number of rows.
+ * @param cols Receives the number of columns.
+ */
+BRAIN_API void brain_sim_size(const brain_sim *sim, int *rows, int *cols);
+
+/**
+ * @brief Copy a row of the current generation.
+ *
+ * @param sim Simulation to read.
+ * @param i Row to copy.
+ * @param dst Receives cols cell states.
+ */
+BRAIN_API void brain_sim_read_row(const brain_sim *sim, int i, uint8_t *dst);
+
+/**
+ * @brief Overwrite a row of the current generation.
+ *
+ * @param sim Simulation to write.
+ * @param i Row to overwrite.
+ * @param src Cols cell states.
+ */
+BRAIN_API void brain_sim_write_row(brain_sim *sim, int i, const uint8_t *src);
+
+/**
+ * @brief Count the population of the current generation.
+ *
+ * @param sim Simulation to count.
+ * @param p Receives the population.
+ */
+BRAIN_API void brain_sim_census(const brain_sim *sim, brain_population *p);
+
+/**
+ * @brief Open a sink writing frames to a file, as --format and --output do.
+ *
+ * @param format Name of the frame format (NULL for avi).
+ * @param path Output file, named pipe or "-" for stdout.
+ * @param rows Number of rows in each frame.
+ * @param cols Number of columns in each frame.
+ * @return brain_sink* New sink, or NULL if the format is unknown or the output
+ * could not be opened (reported on stderr).
+ */
+BRAIN_API brain_sink *brain_sink_open(const char *format, const char *path,
+                                      int rows, int cols);
+
+/**
+ * @brief Open a sink handing every frame to a function instead.
+ *
+ * @param fn Function receiving the frames, on the thread writing them.
+ * @param user Passed to fn along with each frame.
+ * @param rows Number of rows in each frame.
+ * @param cols Number of columns in each frame.
+ * @return brain_sink* New sink, or NULL if its frame could not be allocated.
+ */
+BRAIN_API brain_sink *brain_sink_callback(brain_frame_fn fn, void *user,
+                                          int rows, int cols);
+
+/**
+ * @brief Write the current generation of a simulation as the next frame.
+ *
+ * @param out Sink receiving the frame.
+ * @param sim Simulation of the same size as the sink.
+ * @return int 0, or -1 if the sizes differ or the sink could not write this
+ * frame or an earlier one (reported on stderr).
+ */
+BRAIN_API int brain_sink_write(brain_sink *out, const brain_sim *sim);
+
+/**
+ * @brief Finish the frames of a sink and release it.
+ *
+ * @param out Sink to close.
+ * @return int 0, or -1 if not every frame could be written (reported on
+ * stderr).
+ */
+BRAIN_API int brain_sink_close(brain_sink *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,673 @@
+/**
+ * @file brain_internal.hpp
+ * @author Mahyar Mirrashed (mirrashm@myumanitoba.ca)
+ * @brief Simulation engines, grids, seeding and sinks shared by the
+ * command line and libbrain.
+ * @version 0.2.2
+ * @date 2022-08-10
+ *
+ * @copyright Copyright (c) 2022 Mahyar Mirrashed
+ *
+ */
+
+#ifndef BRAIN_INTERNAL_HPP
+#define BRAIN_INTERNAL_HPP
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <opencv2/core.hpp>
+#include <opencv2/core/ocl.hpp>
+#include <opencv2/highgui.hpp>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef USE_TRACE
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "brain.hpp"
+
+//-----------------------------------------------------------------------------
+// CONSTANTS
+//-----------------------------------------------------------------------------
+
+static const cv::Vec3b ON = cv::Vec3b({255, 255, 255});
+static const cv::Vec3b DYING = cv::Vec3b({255, 0, 0});
+static const cv::Vec3b OFF = cv::Vec3b({0, 0, 0});
+
+// cell states stored in the simulation grid (one byte per cell)
+#define CELL_OFF   0
+#define CELL_ON    1
+#define CELL_DYING 2
+// number of cell states of Brian's Brain
+#define CELL_STATES 3
+// most cell states a rule may have
+#define MAX_CELL_STATES 16
+// entries of each palette lookup (a level per byte for --scale-mode density)
+#define PALETTE_ENTRIES 256
+
+// most rows or columns of a grid
+#define MAX_GRID_SIZE (1 << 20)
+// most cells a side of the block shown by one pixel of a frame
+#define MAX_SCALE 65535
+
+// frames per second of the videos
+#define DEFAULT_FPS 30
+// codec of the videos written through OpenCV, and the ffmpeg encoders tried
+// in turn by --codec auto
+#define CODEC_FFV1 "ffv1"
+#define CODEC_CANDIDATES {"h264_nvenc", "hevc_nvenc", "h264_qsv", "h264_vaapi"}
+// device the frames are uploaded to for the VAAPI encoders
+#define VAAPI_DEVICE "/dev/dri/renderD128"
+
+// default tile of the step traversal and the candidates tried by --tile auto
+// (0 columns spans the whole row)
+#define DEFAULT_TILE_ROWS 64
+#define DEFAULT_TILE_COLS 256
+#define TILE_CANDIDATES                                                        \
+  {{8, 0}, {16, 2048}, {32, 1024}, {64, 256}, {64, 512}, {128, 128}, {256, 64}}
+// sweeps timed per candidate tile when auto-tuning
+#define TILE_TUNING_SWEEPS 3
+
+// generations advanced per pass over the grid by the temporal engine
+#define DEFAULT_TEMPORAL_DEPTH 4
+#define MAX_TEMPORAL_DEPTH     64
+
+// frames per segment when the video is encoded by several writers at once
+#define DEFAULT_SEGMENT_FRAMES 300
+// list of the segments, next to the video they are joined into
+#define SEGMENT_LIST_EXTENSION ".ffconcat"
+
+// refreshes per second of the preview, and the largest preview window
+#define DEFAULT_PREVIEW_FPS 10
+#define PREVIEW_WIDTH       1280
+#define PREVIEW_HEIGHT      720
+// title of the preview window
+#define PREVIEW_TITLE "Brian's Brain"
+
+// temporary video written (and removed) when benchmarking the encoder
+#define BENCH_VIDEO_TEMPLATE "/tmp/brains-brain-XXXXXX.avi"
+// recorded runs of a configuration --bench-history compares a benchmark with,
+// and the slowdown from their median failing it (in percent)
+#define BENCH_HISTORY_RUNS      10
+#define DEFAULT_BENCH_TOLERANCE 10
+
+// default to a checkpoint every minute of video
+#define DEFAULT_CHECKPOINT_INTERVAL 1800
+// leading bytes of a checkpoint file and the revision of its layout: 1 held
+// Brian's Brain at CHECKPOINT_BITS, 2 added the bits per cell of other rules,
+// and 3 the rule itself
+#define CHECKPOINT_MAGIC   "BBRAINCK"
+#define CHECKPOINT_VERSION 3
+// bits per cell in a checkpoint, wide enough for up to 4 and 16 cell states
+#define CHECKPOINT_BITS      2
+#define CHECKPOINT_WIDE_BITS 4
+
+// leading (and trailing) bytes of a recording and the revision of its layout
+#define RECORDING_MAGIC   "BBRAINFR"
+#define RECORDING_VERSION 1
+// default frames from one key frame of a recording to the next
+#define DEFAULT_KEYFRAME_INTERVAL 300
+// encoded bytes of a recording buffered before they are written out
+#define RECORDING_FLUSH_BYTES (4 << 20)
+
+//-----------------------------------------------------------------------------
+// ARGUMENT PARSER SETUP
+//-----------------------------------------------------------------------------
+
+// names of the values of the enumerated options
+static const char *const SIMD_NAMES[] = {"auto", "scalar", "avx2", "avx512",
+                                         "neon"};
+static const char *const ENGINE_NAMES[] = {"byte", "bitboard", "opencl",
+                                           "temporal", "hashlife"};
+static const char *const FORMAT_NAMES[] = {"avi", "avi-gray", "rgb24", "gray8",
+                                           "cells", "bbrain", "none"};
+static const char *const PIN_NAMES[] = {"none", "compact", "spread"};
+static const char *const SCHEDULE_NAMES[] = {"static", "dynamic", "guided",
+                                             "auto"};
+static const char *const PREVIEW_NAMES[] = {"none", "window", "terminal"};
+static const char *const STATS_NAMES[] = {"csv", "ndjson"};
+static const char *const SCALE_NAMES[] = {"majority", "density"};
+static const char *const CYCLE_NAMES[] = {"ignore", "stop", "repeat"};
+
+// instruction sets the step kernel can be compiled for (as in SIMD_NAMES)
+typedef enum {
+  SIMD_AUTO,
+  SIMD_SCALAR,
+  SIMD_AVX2,
+  SIMD_AVX512,
+  SIMD_NEON,
+} simd_isa;
+
+// simulation engines selectable from the command line (as in ENGINE_NAMES)
+typedef enum {
+  ENGINE_BYTE,
+  ENGINE_BITBOARD,
+  ENGINE_OPENCL,
+  ENGINE_TEMPORAL,
+  ENGINE_HASHLIFE,
+} engine_type;
+
+// neighborhoods whose live cells are counted by a rule
+typedef enum {
+  NEIGHBORHOOD_MOORE,       // the eight surrounding cells
+  NEIGHBORHOOD_VON_NEUMANN, // the four orthogonally adjacent cells
+} neighborhood;
+
+// Rule of the Generations family. An off cell with a number of live neighbors
+// in birth turns on, an on cell with a number in survive stays on, and every
+// other on cell goes through the refractory states (CELL_DYING onwards) one
+// generation at a time before turning off. Brian's Brain is B2/S/C3.
+typedef struct {
+  uint16_t birth;   // bit n set if n live neighbors turn an off cell on
+  uint16_t survive; // bit n set if n live neighbors keep an on cell on
+  int states;       // number of cell states, off and on included
+  neighborhood shape;
+} automaton_rule;
+
+// block of cells swept by one thread before moving on to the next block
+typedef struct {
+  int rows;
+  int cols; // 0 spans the whole row
+} tile_size;
+
+// placements of the simulation threads on the CPUs (as in PIN_NAMES)
+typedef enum {
+  PIN_NONE,
+  PIN_COMPACT,
+  PIN_SPREAD,
+} pin_policy;
+
+// ways the tiles of a step are shared between the threads (as in
+// SCHEDULE_NAMES)
+typedef enum {
+  SCHEDULE_STATIC,
+  SCHEDULE_DYNAMIC,
+  SCHEDULE_GUIDED,
+  SCHEDULE_AUTO,
+} schedule_kind;
+
+// places the preview can be shown in (as in PREVIEW_NAMES)
+typedef enum {
+  PREVIEW_NONE,
+  PREVIEW_WINDOW,
+  PREVIEW_TERMINAL,
+} preview_mode;
+
+// formats the frames can be emitted in (as in FORMAT_NAMES)
+typedef enum {
+  FORMAT_AVI,
+  FORMAT_AVI_GRAY,
+  FORMAT_RGB24,
+  FORMAT_GRAY8,
+  FORMAT_CELLS,
+  FORMAT_BBRAIN,
+  FORMAT_NONE,
+} output_format;
+
+// ways a square of cells is shown by one pixel (as in SCALE_NAMES)
+typedef enum {
+  SCALE_MAJORITY, // the most common state (ties to the later state)
+  SCALE_DENSITY,  // PALETTE_ENTRIES - 1 times the share of cells not off
+} scale_kind;
+
+// formats the population records can be written in (as in STATS_NAMES)
+typedef enum {
+  STATS_CSV,
+  STATS_NDJSON,
+} record_format;
+
+// what a run does once its frames repeat (as in CYCLE_NAMES)
+typedef enum {
+  CYCLE_IGNORE,
+  CYCLE_STOP,
+  CYCLE_REPEAT,
+} cycle_action;
+
+typedef struct {
+  int frames;
+  bool framed; // frame count was given on the command line
+  int columns;
+  int rows;
+  cv::Rect viewport; // no width for the whole grid
+  bool placed;       // offsets of the viewport were given
+  int scale;
+  scale_kind scale_mode;
+  simd_isa simd;
+  engine_type engine;
+  bool autotune;
+  tile_size tile;
+  int threads;    // 0 keeps the OpenMP default
+  schedule_kind schedule;
+  int chunk;      // tiles handed out at a time (0 for the default)
+  int queue_depth;
+  int encoders;
+  int segment_frames;
+  bool keep_segments;
+  const char *output;
+  output_format format;
+  const char *codec; // CODEC_FFV1 or an ffmpeg encoder
+  int fps;
+  const char *bitrate; // as ffmpeg takes it (NULL for the encoder's)
+  int keyframe_interval;
+  const char *replay;
+  int replay_from;
+  bool benchmark;
+  const char *bench_sizes;
+  const char *bench_threads;
+  const char *bench_json;
+  const char *bench_history;
+  int bench_tolerance; // percent
+  bool verify;
+  const char *checkpoint;
+  int checkpoint_interval;
+  const char *resume;
+  bool seeded; // seed was given on the command line
+  uint64_t seed;
+  int frame_stride;
+  int temporal_depth;
+  automaton_rule rule;
+  bool huge_pages;
+  pin_policy pin;
+  preview_mode preview;
+  int preview_fps;
+  int hash_memory; // megabytes
+  const char *stats;
+  record_format stats_format;
+  cycle_action on_cycle;
+  const char *trace;
+  const char *jobs;
+} arguments;
+
+extern arguments args;
+
+//-----------------------------------------------------------------------------
+// SIMULATION GRID
+//-----------------------------------------------------------------------------
+
+// Simulation grid storing one byte per cell, independent of the BGR frames
+// handed to the video stream. Every row is surrounded by a halo of OFF cells
+// (one row above and below, padding to the left and right) so the kernel can
+// read the whole Moore neighborhood of any cell without bounds checks.
+typedef struct {
+  int rows;
+  int cols;
+  size_t stride;  // bytes between the start of consecutive rows
+  size_t bytes;   // length of the allocation
+  uint8_t *mem;   // start of the allocation (including halo rows)
+  uint8_t *cells; // first interior cell (row 0, column 0)
+} grid;
+
+// Population of a generation: the cells on and in a refractory state (all the
+// others being off), and the bounding box of the cells that are not off. With
+// --on-cycle, a hash of each cell not off (of its position and state) is
+// summed up too, so that the counts of any parts of a grid add up to the
+// hash of the whole grid.
+typedef struct {
+  uint64_t on;
+  uint64_t dying;
+  int top, left;     // first row and column (INT_MAX if all cells are off)
+  int bottom, right; // last row and column (-1 if all cells are off)
+  uint64_t hash;     // sum of the hashes of the cells (0 without --on-cycle)
+} population;
+
+// population of a grid with every cell off
+static const population EMPTY_POPULATION = {0, 0, INT_MAX, INT_MAX, -1, -1, 0};
+
+// Kernel advancing one grid row by a generation. It reads the row above, the
+// row itself and the row below (each valid from index -1 to cols) and writes
+// cols cells of the next generation.
+typedef void (*row_kernel)(
+  const uint8_t *__restrict__ up, const uint8_t *__restrict__ mid,
+  const uint8_t *__restrict__ down, uint8_t *__restrict__ dst, const int cols
+);
+
+// Activity of the traversal tiles of one generation: a flag per tile telling
+// whether it may hold cells that are not off. A tile of the next generation is
+// only recomputed if a tile around it is live, everything else stays off.
+struct activity {
+  int th, tw;                // tile height in rows, width in grid units
+  int nr, nc;                // tiles down and across the grid
+  std::vector<uint8_t> live; // nr * nc flags (empty if not laid out yet)
+  std::vector<int> work;     // tiles to step, listed by --schedule auto
+};
+
+//-----------------------------------------------------------------------------
+// SIMULATION ENGINES
+//-----------------------------------------------------------------------------
+
+// Simulation engine owning the current and the next generation of the
+// automaton. Cells cross the interface one row at a time as CELL_* bytes, so
+// seeding and frame emission do not depend on the engine's own layout.
+struct engine {
+  bool failed = false; // the engine could not be set up (reported on stderr)
+
+  virtual ~engine() = default;
+  // advance the automaton by one generation
+  virtual void step() = 0;
+  // compute the next generation without making it current
+  virtual void sweep() = 0;
+  // advance the automaton by n generations
+  virtual void advance(const int n) {
+    for (int k = 0; k < n; k += 1)
+      step();
+  }
+  // copy row i of the current generation into cols bytes
+  virtual void read_row(const int i, uint8_t *dst) const = 0;
+  // copy cells [j, j + n) of row i of the current generation into n bytes
+  virtual void read_cells(const int i, const int j, const int n,
+                          uint8_t *dst) const {
+    thread_local std::vector<uint8_t> row;
+
+    row.resize(cols());
+    read_row(i, row.data());
+    memcpy(dst, row.data() + j, n);
+  }
+  // copy the whole current generation into a frame of cell states in one go,
+  // or return false if it is better read row by row
+  virtual bool read_frame(cv::Mat &) const { return false; }
+  // overwrite row i of the current generation with cols bytes (distinct rows
+  // of an engine that has not stepped yet may be written concurrently)
+  virtual void write_row(const int i, const uint8_t *src) = 0;
+  // bytes held by one generation
+  virtual size_t footprint() const = 0;
+  // size of the grid
+  virtual int rows() const = 0;
+  virtual int cols() const = 0;
+  // whether cells [j, j + n) of row i of the current generation may not all be
+  // off (engines that do not track activity always answer true)
+  virtual bool active(const int, const int, const int) const { return true; }
+  // population of the current generation if it was counted while stepping
+  // (only done with --stats or --on-cycle), or false if it has to be counted
+  virtual bool census(population &) const { return false; }
+};
+
+//-----------------------------------------------------------------------------
+// ENCODER PIPELINE
+//-----------------------------------------------------------------------------
+
+// Kernel mapping a row of cell states to pixels through a palette holding
+// channels bytes per cell state.
+typedef void (*palette_kernel)(
+  const uint8_t *__restrict__ cells, uint8_t *__restrict__ dst, const int cols,
+  const uint8_t *palette, const int channels
+);
+
+// Arena the frames of the pipeline are carved from, so that the ring and the
+// sinks share preallocated buffers and nothing is allocated per frame. Rows of
+// every frame start on a GRID_ALIGN boundary. Frames are handed out while the
+// pipeline is set up and released all at once.
+struct frame_arena {
+  std::vector<std::pair<uint8_t *, size_t>> chunks; // mappings and lengths
+  std::vector<std::pair<uint8_t *, size_t>> spare;  // frames given back
+  size_t used;        // bytes handed out from the last chunk
+  size_t allocations; // frames carved since the arena was last released
+  std::mutex lock;    // held while frames are handed out or given back
+};
+
+// Destination of the emitted frames, fed by the encoder thread. Frames arrive
+// as single-channel cell states and are only mapped to pixels if the sink's
+// container needs them.
+struct sink {
+  const uint8_t *palette; // channels bytes per cell state (NULL keeps states)
+  int channels;
+  cv::Mat pixels[2];      // mapped frames, filled alternately
+  int current;
+  bool failed; // a frame could not be opened or written (reported on stderr)
+
+  sink(const uint8_t *palette, const int channels, const int rows,
+       const int cols);
+  // gives the mapped frames back to the arena
+  virtual ~sink();
+  // emit one frame of cell states (dropped once the sink failed)
+  virtual void write(const cv::Mat &cells) = 0;
+  // write out whatever the sink still holds, after its last frame
+  virtual void finish() {}
+  // number of frames the sink may still reference after write() returns
+  virtual int retained() const { return 0; }
+  // map a frame of cell states through the palette
+  const cv::Mat &expand(const cv::Mat &cells);
+};
+
+// Sink encoding frames into a video file, through OpenCV for FFV1 or by
+// piping them to an ffmpeg encoder of --codec (hardware ones included).
+struct video_sink : sink {
+  cv::VideoWriter video;
+  cv::Size size;
+  pid_t encoder; // ffmpeg encoding the current video (0 through OpenCV)
+  int fd;        // input of the encoder
+  std::vector<struct iovec> iov; // rows of the frame being piped
+
+  video_sink(const char *path, const int rows, const int cols,
+             const uint8_t *palette, const int channels);
+  ~video_sink() override;
+  // finish the current video and start a new one at path
+  void open(const char *path);
+  void write(const cv::Mat &cells) override;
+  void finish() override;
+};
+
+// Region of the grid the frames show, each pixel standing for a square of
+// scale by scale cells of it (the squares of the last row and column of
+// pixels possibly being cut short by the edge of the region).
+typedef struct {
+  int top, left;     // first row and column of the grid shown
+  int rows, cols;    // cells of the grid shown
+  int scale;         // cells a side per pixel
+  scale_kind mode;
+  int height, width; // size of the frames
+  bool cropped;      // frames do not show each cell of the grid once
+} frame_view;
+
+// Frame of a ring, together with the row segments of it known to be all off
+// so that colorizing a quiescent region does not rewrite it every time.
+struct frame_slot {
+  cv::Mat frame;
+  int width;                  // columns per row segment of the blank map
+  std::vector<uint8_t> blank; // one flag per row segment
+};
+
+//-----------------------------------------------------------------------------
+// RECORDINGS
+//-----------------------------------------------------------------------------
+
+// Header of a recording (--format bbrain). Every frame follows it as its grid
+// packed like a checkpoint and XORed with the packed grid of the frame before
+// (with nothing for key frames), run-length encoded as pairs of varint counts:
+// bytes left as they are, then bytes given literally. The frames are followed
+// by their offsets and a trailer, so a recording can be streamed out and yet
+// seeked into once mapped. Fields are stored in the host's byte order.
+typedef struct {
+  char magic[8];               // RECORDING_MAGIC (not terminated)
+  uint32_t version;            // RECORDING_VERSION
+  uint32_t rows;
+  uint32_t cols;
+  uint32_t bits;               // bits per packed cell
+  uint32_t states;             // cell states of the rule recorded
+  uint32_t keyframe_interval;  // frames from one key frame to the next
+  uint8_t padding[32];
+} recording_header;
+
+// Last bytes of a recording.
+typedef struct {
+  uint64_t frames;
+  uint64_t index;              // offset of the frame offsets (one per frame)
+  char magic[8];               // RECORDING_MAGIC (not terminated)
+} recording_trailer;
+
+//-----------------------------------------------------------------------------
+// INSTRUMENTATION
+//-----------------------------------------------------------------------------
+
+// Instrumented builds (make TRACE=1) time the step, colorize and encode spans
+// of every thread, together with the hardware counters each one consumed, and
+// write them to the --trace file. Other builds compile the spans away.
+#ifdef USE_TRACE
+// hardware counters read at both ends of every span
+typedef enum {
+  TRACE_CYCLES,
+  TRACE_INSTRUCTIONS,
+  TRACE_LLC_MISSES,
+  TRACE_COUNTERS,
+} trace_counter;
+
+// span of one thread
+typedef struct {
+  const char *name;
+  double start, end;               // seconds()
+  pid_t tid;
+  uint64_t region;                 // parallel region of the span (0 if none)
+  uint64_t counts[TRACE_COUNTERS]; // consumed during the span
+} trace_event;
+
+// Span recorded from its construction to its destruction (if --trace is
+// given). Spans of the threads of a parallel region are compared with each
+// other to measure how evenly the region's work was shared.
+struct trace_span {
+  trace_event event;
+
+  trace_span(const char *name, const bool parallel);
+  ~trace_span();
+};
+
+// time the rest of the enclosing scope, on one thread or on each thread of
+// the parallel region started after TRACE_REGION()
+#define TRACE_SPAN(name)   trace_span trace_scope(name, false)
+#define TRACE_THREAD(name) trace_span trace_scope(name, true)
+#define TRACE_REGION()     (trace_region += 1)
+#else
+#define TRACE_SPAN(name)
+#define TRACE_THREAD(name)
+#define TRACE_REGION()
+#endif
+
+//-----------------------------------------------------------------------------
+// PROTOTYPES
+//-----------------------------------------------------------------------------
+
+void arguments_default(arguments &a);
+void rule_apply(void);
+bool rule_runs(const engine_type type, const automaton_rule &r);
+void codec_options(const char *codec, std::vector<const char *> &argv);
+void brain(const grid &__restrict__ in, grid &__restrict__ out,
+           const activity &in_live, activity &out_live, population *census);
+bool parse_rule(const char *arg, automaton_rule &r);
+bool same_rule(const automaton_rule &a, const automaton_rule &b);
+row_kernel select_rule_kernel(const automaton_rule &r, const simd_isa isa);
+simd_isa resolve_isa(const simd_isa isa);
+bool simd_supported(const simd_isa isa);
+void census_take(const engine &e, population &p);
+void pack_row(const uint8_t *__restrict__ cells, uint8_t *__restrict__ packed,
+              const int cols, const int bits);
+void colorize(const engine &e, frame_slot &slot);
+engine *engine_create(const engine_type type, const int rows, const int cols);
+void schedule_apply(void);
+bool grid_create(grid &g, const int rows, const int cols);
+void grid_destroy(grid &g);
+uint8_t *grid_row(const grid &g, const int i);
+double seconds(void);
+uint64_t random_word(const uint64_t seed, const uint64_t n);
+void seed_cells(uint8_t *dst, const int i, const int j0, const int n,
+                const int rows, const int cols, const uint64_t seed);
+void seed_random(engine &e, const uint64_t seed);
+int tile_count(const int size, const int block);
+int lookup_name(const char *const *names, const size_t count, const char *name);
+void palette_row_scalar(
+  const uint8_t *__restrict__ cells, uint8_t *__restrict__ dst, const int cols,
+  const uint8_t *palette, const int channels
+);
+void palette_fill(const int states);
+cv::Mat arena_frame(frame_arena &a, const int rows, const int cols,
+                    const int channels);
+void arena_recycle(frame_arena &a, const cv::Mat &frame);
+sink *sink_create(const output_format format, const char *path, const int rows,
+                  const int cols, const int depth);
+
+//-----------------------------------------------------------------------------
+// ARGUMENT PARSER INITIALIZATION
+//-----------------------------------------------------------------------------
+
+// step kernel used by brain(), picked once the arguments are parsed
+extern row_kernel brain_row;
+
+// palette lookup used by the sinks, picked once the arguments are parsed
+extern palette_kernel palette_row;
+
+// number of cell states of the rule being run
+extern int cell_states;
+
+// colour of each cell state when a frame is emitted (indexed by cell state),
+// with the channels in BGR and RGB order and as luma, filled by palette_fill()
+extern cv::Vec3b palette_bgr[PALETTE_ENTRIES];
+extern cv::Vec3b palette_rgb[PALETTE_ENTRIES];
+extern uint8_t palette_gray[PALETTE_ENTRIES];
+
+// Rules that can be named on the command line. Each one gets a step kernel
+// specialized for it at compile time.
+typedef struct {
+  const char *name;
+  automaton_rule rule;
+  row_kernel kernel;
+} rule_preset;
+
+// Brian's Brain comes first (it is also run by the bitboard and OpenCL
+// engines, and has vectorized kernels of its own)
+extern const rule_preset RULES[];
+
+// traversal block used by the engines, picked once the arguments are parsed
+extern tile_size tile;
+
+// part of the grid the frames show, laid out by view_apply() (every cell of
+// the grid until then)
+extern frame_view view;
+
+// frame buffers of the ring and the sinks
+extern frame_arena pool;
+
+#ifdef USE_TRACE
+// spans recorded so far
+extern std::vector<trace_event> trace_events;
+extern std::mutex trace_lock;
+// parallel regions started so far, numbering the spans of their threads
+extern std::atomic<uint64_t> trace_region;
+#endif
+
+#endif
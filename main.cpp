@@ -10,32 +10,19 @@
  */
 
 #include <argp.h>
-#include <errno.h>
-#include <limits.h>
-#include <stdint.h>
-#include <stdlib.h>
-#include <sys/ioctl.h>
-#include <unistd.h>
-#include <opencv2/core.hpp>
-#include <opencv2/highgui.hpp>
+#include <sched.h>
+#include <wordexp.h>
 
-#ifdef _OPENMP
-#include <omp.h>
+#ifdef USE_MPI
+#include <mpi.h>
 #endif
 
+#include "brain_internal.hpp"
+
 //-----------------------------------------------------------------------------
 // CONSTANTS
 //-----------------------------------------------------------------------------
 
-// default to 60 seconds of video
-#define DEFAULT_FRAME_COUNT 1800
-// default standard high-definition (HD) display resolution (720p)
-#define DEFAULT_COLUMNS 1280
-#define DEFAULT_ROWS    720
-
-// default seeding area for random initialization (always square)
-#define DEFAULT_SEED_AREA 0.4
-
 // progress bar constants
 #define MAX_PROGRESS 100
 #define PROGRESS_BAR                                                           \
@@ -45,9 +32,71 @@
   "                                                                          " \
   "                          "
 
-static const cv::Vec3b ON = cv::Vec3b({255, 255, 255});
-static const cv::Vec3b DYING = cv::Vec3b({255, 0, 0});
-static const cv::Vec3b OFF = cv::Vec3b({0, 0, 0});
+// cells per thread given to a job of a --jobs batch (smaller grids get one)
+#define JOB_CELLS_PER_THREAD (1 << 20)
+
+// earlier frames a frame is compared with by --on-cycle, and the bytes of
+// frames kept to repeat a cycle found (longer cycles are simulated on)
+#define MAX_CYCLE_PERIOD 4096
+#define CYCLE_BYTES      (1ull << 30)
+
+// grids checked by --verify unless --bench-sizes is given: single cells, rows
+// and columns, odd sizes, and sizes either side of a 64-cell word
+#define VERIFY_SIZES                                                           \
+  "1x1,9x1,1x9,3x3,2x5,63x65,65x63,127x129,129x7,257x31,1000x19"
+// generations checked unless --frames is given, and seed unless --seed is
+#define VERIFY_GENERATIONS 100
+#define VERIFY_SEED        2022
+// generations per frame checked besides single steps, and small odd tile
+// checked besides --tile
+#define VERIFY_STRIDE    5
+#define VERIFY_TILE_ROWS 7
+#define VERIFY_TILE_COLS 13
+
+// long-only command line options
+#define KEY_SIMD   0x100
+#define KEY_ENGINE 0x101
+#define KEY_TILE   0x102
+#define KEY_QUEUE  0x103
+#define KEY_FORMAT 0x104
+#define KEY_BENCH  0x105
+#define KEY_SIZES  0x106
+#define KEY_CORES  0x107
+#define KEY_JSON   0x108
+#define KEY_CKPT   0x109
+#define KEY_EVERY  0x10a
+#define KEY_RESUME 0x10b
+#define KEY_SEED   0x10c
+#define KEY_STRIDE 0x10d
+#define KEY_DEPTH  0x10e
+#define KEY_RULE   0x10f
+#define KEY_HUGE   0x110
+#define KEY_PIN    0x111
+#define KEY_VIEW   0x112
+#define KEY_VFPS   0x113
+#define KEY_HMEM   0x114
+#define KEY_STATS  0x115
+#define KEY_SFMT   0x116
+#define KEY_ENCODE 0x117
+#define KEY_SEGLEN 0x118
+#define KEY_KEEP   0x119
+#define KEY_KEYINT 0x11a
+#define KEY_REPLAY 0x11b
+#define KEY_RFROM  0x11c
+#define KEY_TRACE  0x11d
+#define KEY_THREAD 0x11e
+#define KEY_SCHED  0x11f
+#define KEY_JOBS   0x120
+#define KEY_CODEC  0x121
+#define KEY_FPS    0x122
+#define KEY_RATE   0x123
+#define KEY_VPORT  0x124
+#define KEY_SCALE  0x125
+#define KEY_SMODE  0x126
+#define KEY_CYCLE  0x127
+#define KEY_VERIFY 0x128
+#define KEY_HIST   0x129
+#define KEY_TOL    0x12a
 
 //-----------------------------------------------------------------------------
 // ARGUMENT PARSER SETUP
@@ -58,6 +107,7 @@ const char *argp_program_bug_address = "<mirrashm@myumanitoba.ca>";
 
 static char args_doc[] = "";
 static char doc[] = "Brian's Brian cellular automaton video generator.";
+static char job_doc[] = "Options of one job of a --jobs file.";
 
 static struct argp_option options[] = {
   {.name = "frames",
@@ -70,43 +120,660 @@ static struct argp_option options[] = {
    .key = 'c',
    .arg = "COLUMNS",
    .flags = 0,
-   .doc = "Number of columns in each frame",
+   .doc = "Number of columns of the grid (and of each frame)",
+   .group = 0},
+  {.name = "rows",
+   .key = 'r',
+   .arg = "ROWS",
+   .flags = 0,
+   .doc = "Number of rows of the grid (and of each frame)",
+   .group = 0},
+  {.name = "viewport",
+   .key = KEY_VPORT,
+   .arg = "WxH[+X+Y]",
+   .flags = 0,
+   .doc = "Only emit a W by H region of the grid, X columns and Y rows from "
+          "its top left corner (default the whole grid, centred if X and Y "
+          "are left out)",
+   .group = 0},
+  {.name = "scale",
+   .key = KEY_SCALE,
+   .arg = "CELLS",
+   .flags = 0,
+   .doc = "Emit a pixel per square of CELLS by CELLS cells of the viewport "
+          "(default 1)",
+   .group = 0},
+  {.name = "scale-mode",
+   .key = KEY_SMODE,
+   .arg = "MODE",
+   .flags = 0,
+   .doc = "Pixel of a square of cells: majority (its most common state, "
+          "default) or density (shaded by its share of cells not off)",
+   .group = 0},
+  {.name = "simd",
+   .key = KEY_SIMD,
+   .arg = "ISA",
+   .flags = 0,
+   .doc = "Step kernel instruction set: auto (default), avx512, avx2, neon or "
+          "scalar",
+   .group = 0},
+  {.name = "engine",
+   .key = KEY_ENGINE,
+   .arg = "ENGINE",
+   .flags = 0,
+   .doc = "Simulation engine: byte (one byte per cell, default), bitboard "
+          "(two bits per cell, 64 cells per word), temporal (byte cells, "
+          "several generations per pass between strided frames), opencl "
+          "(both generations kept on an OpenCL device) or hashlife (memoized "
+          "quadtree jumping over strided frames)",
+   .group = 0},
+  {.name = "hash-memory",
+   .key = KEY_HMEM,
+   .arg = "MEGABYTES",
+   .flags = 0,
+   .doc = "Memory the hashlife engine may fill before dropping the nodes the "
+          "current generation does not use (default 1024)",
+   .group = 0},
+  {.name = "rule",
+   .key = KEY_RULE,
+   .arg = "RULE",
+   .flags = 0,
+   .doc = "Generations rule to run: brain (default), life, star-wars, frogs, "
+          "spirals, sticks, transers, lava, or survive/birth/states counts "
+          "(such as 345/2/4 or B2/S345/C4, with a trailing V for the von "
+          "Neumann neighborhood)",
+   .group = 0},
+  {.name = "preview",
+   .key = KEY_VIEW,
+   .arg = "MODE",
+   .flags = OPTION_ARG_OPTIONAL,
+   .doc = "Show the latest frame while generating, in a window (default) or "
+          "in the terminal, downsampled to fit",
+   .group = 0},
+  {.name = "preview-fps",
+   .key = KEY_VFPS,
+   .arg = "FPS",
+   .flags = 0,
+   .doc = "Most refreshes per second of the preview (default 10)",
+   .group = 0},
+  {.name = "huge-pages",
+   .key = KEY_HUGE,
+   .arg = NULL,
+   .flags = 0,
+   .doc = "Back the simulation grids and frame buffers with huge pages "
+          "(reserved ones when available, transparent ones otherwise)",
+   .group = 0},
+  {.name = "pin",
+   .key = KEY_PIN,
+   .arg = "POLICY",
+   .flags = 0,
+   .doc = "Pin each simulation thread to a CPU: none (default), compact (one "
+          "socket filled before the next) or spread (threads dealt out to "
+          "the sockets in turn)",
+   .group = 0},
+  {.name = "temporal-depth",
+   .key = KEY_DEPTH,
+   .arg = "GENERATIONS",
+   .flags = 0,
+   .doc = "Generations the temporal engine advances a tile by before writing "
+          "it back (default 4)",
+   .group = 0},
+  {.name = "frame-stride",
+   .key = KEY_STRIDE,
+   .arg = "GENERATIONS",
+   .flags = 0,
+   .doc = "Generations simulated per frame, the ones in between never being "
+          "emitted (default 1)",
+   .group = 0},
+  {.name = "threads",
+   .key = KEY_THREAD,
+   .arg = "THREADS",
+   .flags = 0,
+   .doc = "Number of simulation threads (default one per CPU, or "
+          "OMP_NUM_THREADS)",
+   .group = 0},
+  {.name = "schedule",
+   .key = KEY_SCHED,
+   .arg = "KIND[,CHUNK]",
+   .flags = 0,
+   .doc = "How the tiles of a step are shared between the threads: static "
+          "(default), dynamic, guided, or auto (only the tiles near activity, "
+          "handed out dynamically), optionally CHUNK tiles at a time",
+   .group = 0},
+  {.name = "tile",
+   .key = KEY_TILE,
+   .arg = "ROWSxCOLS",
+   .flags = 0,
+   .doc = "Cache block of the step traversal, or auto (default) to pick the "
+          "fastest one at startup",
+   .group = 0},
+  {.name = "queue-depth",
+   .key = KEY_QUEUE,
+   .arg = "FRAMES",
+   .flags = 0,
+   .doc = "Number of frames buffered between the simulation and the encoder",
+   .group = 0},
+  {.name = "encoders",
+   .key = KEY_ENCODE,
+   .arg = "WRITERS",
+   .flags = 0,
+   .doc = "Encode the video as segments on this many writers at once, each "
+          "simulating its segments again from where they start (default 1, "
+          "avi formats only)",
+   .group = 0},
+  {.name = "segment-frames",
+   .key = KEY_SEGLEN,
+   .arg = "FRAMES",
+   .flags = 0,
+   .doc = "Frames per segment when encoding on several writers (default "
+          "300)",
+   .group = 0},
+  {.name = "keep-segments",
+   .key = KEY_KEEP,
+   .arg = NULL,
+   .flags = 0,
+   .doc = "Leave the segments and their ffconcat list as they are instead of "
+          "joining them into the output with ffmpeg",
+   .group = 0},
+  {.name = "output",
+   .key = 'o',
+   .arg = "FILE",
+   .flags = 0,
+   .doc = "Destination of the frames (default automaton.avi, - for stdout)",
+   .group = 0},
+  {.name = "format",
+   .key = KEY_FORMAT,
+   .arg = "FORMAT",
+   .flags = 0,
+   .doc = "Frame format: avi (video of --codec, default), avi-gray "
+          "(single-channel video), raw rgb24, gray8 or cells (one byte per "
+          "cell state) frames, bbrain (packed key frames and run-length "
+          "encoded changes, see --replay), or none (no frames at all)",
+   .group = 0},
+  {.name = "codec",
+   .key = KEY_CODEC,
+   .arg = "CODEC",
+   .flags = 0,
+   .doc = "Codec of avi videos: ffv1 (default, through OpenCV), an ffmpeg "
+          "encoder such as h264_nvenc, hevc_vaapi or h264_qsv (frames piped "
+          "to ffmpeg, falling back to ffv1 if it cannot encode), or auto (the "
+          "first of the hardware encoders that works)",
+   .group = 0},
+  {.name = "fps",
+   .key = KEY_FPS,
+   .arg = "FPS",
+   .flags = 0,
+   .doc = "Frames per second of the video (default 30)",
+   .group = 0},
+  {.name = "bitrate",
+   .key = KEY_RATE,
+   .arg = "RATE",
+   .flags = 0,
+   .doc = "Bit rate of a video encoded by ffmpeg, such as 8M (default the "
+          "encoder's own)",
+   .group = 0},
+  {.name = "keyframe-interval",
+   .key = KEY_KEYINT,
+   .arg = "FRAMES",
+   .flags = 0,
+   .doc = "Frames from one key frame of a bbrain recording to the next "
+          "(default 300)",
+   .group = 0},
+  {.name = "replay",
+   .key = KEY_REPLAY,
+   .arg = "FILE",
+   .flags = 0,
+   .doc = "Export the frames of a bbrain recording to the output format "
+          "instead of simulating (all of them unless --frames is given)",
+   .group = 0},
+  {.name = "replay-from",
+   .key = KEY_RFROM,
+   .arg = "FRAME",
+   .flags = 0,
+   .doc = "First frame of the recording to export (default 0)",
+   .group = 0},
+  {.name = "stats",
+   .key = KEY_STATS,
+   .arg = "FILE",
+   .flags = 0,
+   .doc = "Write the population (on, dying and off cells, and the bounding "
+          "box of the cells that are not off) of every frame to FILE (- for "
+          "stdout)",
+   .group = 0},
+  {.name = "stats-format",
+   .key = KEY_SFMT,
+   .arg = "FORMAT",
+   .flags = 0,
+   .doc = "Format of the population records: csv (default) or ndjson",
+   .group = 0},
+  {.name = "on-cycle",
+   .key = KEY_CYCLE,
+   .arg = "ACTION",
+   .flags = 0,
+   .doc = "Once a frame repeats one of the last 4096 (the cells all died or "
+          "fell into a cycle): ignore it (default), stop the run there, or "
+          "repeat the frames of the cycle instead of simulating them",
+   .group = 0},
+#ifdef USE_TRACE
+  {.name = "trace",
+   .key = KEY_TRACE,
+   .arg = "FILE",
+   .flags = 0,
+   .doc = "Write the time and hardware counters of every step, colorize and "
+          "encode span of each thread to FILE as a Chrome trace",
+   .group = 0},
+#endif
+  {.name = "benchmark",
+   .key = KEY_BENCH,
+   .arg = NULL,
+   .flags = 0,
+   .doc = "Time the step, colorize and encode stages over FRAMES generations "
+          "instead of writing a video",
+   .group = 0},
+  {.name = "bench-sizes",
+   .key = KEY_SIZES,
+   .arg = "WxH,...",
+   .flags = 0,
+   .doc = "Resolutions to benchmark (default COLUMNSxROWS)",
+   .group = 0},
+  {.name = "bench-threads",
+   .key = KEY_CORES,
+   .arg = "N,...",
+   .flags = 0,
+   .doc = "Thread counts to benchmark (default all available threads)",
+   .group = 0},
+  {.name = "bench-json",
+   .key = KEY_JSON,
+   .arg = "FILE",
+   .flags = 0,
+   .doc = "Also write the benchmark results to FILE as JSON",
+   .group = 0},
+  {.name = "bench-history",
+   .key = KEY_HIST,
+   .arg = "FILE",
+   .flags = 0,
+   .doc = "Compare the benchmark results with the runs recorded in FILE, "
+          "failing if any configuration got slower, then record them there",
+   .group = 0},
+  {.name = "bench-tolerance",
+   .key = KEY_TOL,
+   .arg = "PERCENT",
+   .flags = 0,
+   .doc = "Slowdown from the median of the last 10 runs of a configuration "
+          "recorded on this host failing --bench-history (default 10)",
+   .group = 0},
+  {.name = "verify",
+   .key = KEY_VERIFY,
+   .arg = NULL,
+   .flags = 0,
+   .doc = "Check every engine and step kernel against the scalar reference, "
+          "bit for bit, over FRAMES generations (default 100) of odd "
+          "--bench-sizes on each --bench-threads instead of writing a video",
+   .group = 0},
+  {.name = "seed",
+   .key = KEY_SEED,
+   .arg = "SEED",
+   .flags = 0,
+   .doc = "Seed of the random initialization (default drawn at random), the "
+          "same seed giving the same run on any number of threads",
+   .group = 0},
+  {.name = "checkpoint",
+   .key = KEY_CKPT,
+   .arg = "FILE",
+   .flags = 0,
+   .doc = "Periodically save the grid to FILE (and when interrupted) so the "
+          "run can be resumed",
+   .group = 0},
+  {.name = "checkpoint-interval",
+   .key = KEY_EVERY,
+   .arg = "FRAMES",
+   .flags = 0,
+   .doc = "Generations between checkpoints (default 1800)",
+   .group = 0},
+  {.name = "resume",
+   .key = KEY_RESUME,
+   .arg = "FILE",
+   .flags = 0,
+   .doc = "Continue from the grid and generation saved in a checkpoint (its "
+          "size overrides the columns and rows)",
+   .group = 0},
+  {.name = "jobs",
+   .key = KEY_JOBS,
+   .arg = "FILE",
+   .flags = 0,
+   .doc = "Run the simulations listed in FILE side by side, one per line as "
+          "--seed, --columns, --rows, --frames, --frame-stride, --format and "
+          "--output options (the others apply to every job)",
+   .group = 0},
+  {},
+};
+
+// options a line of a --jobs file may give (parsed by parse_opt() as well)
+static struct argp_option job_options[] = {
+  {.name = "seed",
+   .key = KEY_SEED,
+   .arg = "SEED",
+   .flags = 0,
+   .doc = "Seed of the random initialization (default drawn at random)",
+   .group = 0},
+  {.name = "columns",
+   .key = 'c',
+   .arg = "COLUMNS",
+   .flags = 0,
+   .doc = "Number of columns of the grid (and of each frame)",
    .group = 0},
   {.name = "rows",
    .key = 'r',
    .arg = "ROWS",
    .flags = 0,
-   .doc = "Number of rows in each frame",
+   .doc = "Number of rows of the grid (and of each frame)",
+   .group = 0},
+  {.name = "frames",
+   .key = 'f',
+   .arg = "FRAMES",
+   .flags = 0,
+   .doc = "Number of frames to generate",
+   .group = 0},
+  {.name = "frame-stride",
+   .key = KEY_STRIDE,
+   .arg = "GENERATIONS",
+   .flags = 0,
+   .doc = "Generations simulated per frame",
+   .group = 0},
+  {.name = "format",
+   .key = KEY_FORMAT,
+   .arg = "FORMAT",
+   .flags = 0,
+   .doc = "Frame format of the job",
+   .group = 0},
+  {.name = "output",
+   .key = 'o',
+   .arg = "FILE",
+   .flags = 0,
+   .doc = "Destination of the frames of the job (required)",
    .group = 0},
   {},
 };
 
+// timings of one benchmarked configuration
 typedef struct {
-  int frames;
-  int columns;
   int rows;
-} arguments;
+  int cols;
+  int threads;
+  tile_size tile;
+  const char *kernel;
+  double step;      // nanoseconds per cell
+  double colorize;  // nanoseconds per cell
+  double encode;    // nanoseconds per cell
+  double fps;       // generations (frames) per second over all stages
+  double bandwidth; // bytes per second streamed by the step
+  size_t buffers;     // frame buffers taken from the arena up front
+  size_t allocations; // frame buffers allocated while the frames were timed
+} bench_result;
+
+// one way of running a grid checked by --verify
+typedef struct {
+  engine_type type;
+  simd_isa isa;
+  int threads;
+  tile_size tile;
+  int stride; // generations per frame
+} verify_case;
 
-static arguments args;
+//-----------------------------------------------------------------------------
+// ENCODER PIPELINE
+//-----------------------------------------------------------------------------
+
+// Bounded ring of preallocated frames handed from the simulation to the
+// encoder thread. The simulation blocks while every slot is still waiting to
+// be encoded, so it never runs more than the ring's depth ahead.
+struct frame_ring {
+  std::vector<frame_slot> slots;
+  size_t head;  // oldest slot waiting to be encoded
+  size_t count; // slots waiting to be encoded
+  bool closed;  // no more frames will be published
+  std::mutex lock;
+  std::condition_variable filled;  // a frame was published or ring closed
+  std::condition_variable drained; // a frame was encoded
+};
+
+// Writer encoding some of the segments of a segmented run. Each segment is
+// simulated again from a copy of its first generation on the writer's own
+// engine, so the writers only share the scouting engine's snapshots.
+struct segment_writer {
+  engine *sim;     // holds the segment being encoded
+  video_sink *out; // reopened for every segment
+  frame_slot slot; // frame the segment is colorized into
+  int frames;      // frames in the segment being encoded
+  int threads;     // threads of the writer's parallel regions
+  std::thread worker;
+};
+
+// Frames of a run watched for a repeat (--on-cycle). The hashes of the last
+// MAX_CYCLE_PERIOD frames are looked up for each new frame. A frame found
+// again with the same population is only a candidate: its grid is packed and
+// the cycle is taken as found once the exact same grid comes back a period
+// later. Meanwhile, the frames of the cycle it starts are kept to be repeated.
+struct cycle_watch {
+  std::unordered_map<uint64_t, uint64_t> seen; // hash to last frame showing it
+  std::vector<population> recent; // population of each of the last frames
+  uint64_t frames = 0;            // frames looked up so far
+  int period = 0;                 // frames in the cycle (0 without candidate)
+  uint64_t start = 0;             // frame of the candidate
+  population candidate;           // and its population
+  std::vector<uint8_t> snapshot;  // and its grid (see grid_pack())
+  bool found = false;             // the candidate came back a period later
+  bool repeat = false;            // frames of the cycle are kept to be repeated
+  std::vector<cv::Mat> loop;      // frames of the cycle (if any are emitted)
+  std::vector<population> counts; // population of each frame of the cycle
+  size_t next = 0;                // frame of the cycle to repeat next
+};
+
+// Jobs of a --jobs batch. Jobs are started in the order they are listed, each
+// once enough of the threads are free for it, by as many workers as there are
+// threads, so a big job waits for the small ones before it to make room.
+struct job_queue {
+  std::vector<arguments> jobs;
+  size_t next;    // next job to be taken by a worker
+  size_t started; // jobs started so far
+  size_t done;    // jobs finished so far
+  int threads;    // threads shared by the jobs
+  int free;       // threads not given to a running job
+  std::mutex lock;
+  std::condition_variable changed; // a job started or finished
+};
+
+// Mailbox between the simulation and the preview thread. The preview asks for
+// a frame once it is ready to show one, and the simulation only downsamples
+// the frame it has just colorized into the mailbox when asked, so it never
+// waits for the preview nor pays for frames that would not be shown.
+struct preview_box {
+  cv::Mat image;             // downsampled BGR frame
+  int scale;                 // cells per side of each preview pixel
+  std::atomic<bool> wanted;  // the preview is waiting for a frame
+  bool ready;                // image holds a frame not shown yet
+  bool closed;               // no more frames will be offered
+  std::mutex lock;
+  std::condition_variable updated; // a frame was offered or preview closed
+};
+
+//-----------------------------------------------------------------------------
+// DISTRIBUTED SIMULATION
+//-----------------------------------------------------------------------------
+
+#ifdef USE_MPI
+// neighbors of a block, as offsets in blocks down and across (the opposite of
+// direction k is HALO_DIRECTIONS - 1 - k)
+#define HALO_DIRECTIONS 8
+static const int HALO[HALO_DIRECTIONS][2] = {
+  {-1, -1}, {-1, 0}, {-1, 1}, {0, -1}, {0, 1}, {1, -1}, {1, 0}, {1, 1},
+};
+
+// Block of the grid owned by one rank of a 2D Cartesian communicator. The halo
+// of the block holds the cells of the neighboring blocks, refreshed at every
+// generation (and left off past the edges of the grid).
+typedef struct {
+  MPI_Comm comm;
+  int rank, ranks;
+  int rows, cols;                   // size of the whole grid
+  int row0, col0;                   // position of the block in the grid
+  grid cur, next;                   // current and next generation of the block
+  int neighbor[HALO_DIRECTIONS];    // rank of each neighbor (or MPI_PROC_NULL)
+  MPI_Datatype column;              // one column of a block
+} domain;
+#endif
+
+//-----------------------------------------------------------------------------
+// CHECKPOINTS
+//-----------------------------------------------------------------------------
+
+// Header of a checkpoint file. It is followed by the grid packed at bits per
+// cell (the first cell of each byte in the low bits), each row padded to a
+// whole byte. Fields are stored in the host's byte order.
+typedef struct {
+  char magic[8];       // CHECKPOINT_MAGIC (not terminated)
+  uint32_t version;    // CHECKPOINT_VERSION
+  uint32_t rows;
+  uint32_t cols;
+  uint32_t bits;       // bits per cell (always CHECKPOINT_BITS in version 1)
+  uint64_t generation; // generations simulated since the grid was seeded
+  uint64_t seed;       // seed of the random initialization
+  uint16_t birth;      // rule the grid was stepped by (from version 3 on)
+  uint16_t survive;
+  uint16_t states;
+  uint16_t shape;
+  uint8_t padding[16]; // keeps the packed rows cache line aligned
+} checkpoint_header;
 
 //-----------------------------------------------------------------------------
 // PROTOTYPES
 //-----------------------------------------------------------------------------
 
 int main(int argc, char **argv);
-static void brain(const cv::Mat &__restrict__ in, cv::Mat &__restrict__ out);
+static int benchmark(void);
+static int replay(void);
+static int batch(void);
+static void jobs_load(const char *path, std::vector<arguments> &jobs);
+static int job_threads(const arguments &job, const int threads);
+static void job_worker(job_queue &q);
+static void job_run(const arguments &job, const int threads);
+static int segmented(engine *sim, uint64_t generation, const uint64_t seed);
+static void segment_encode(segment_writer &w, std::atomic<int> &encoded);
+static std::string segment_path(const char *output, const int k);
+static bool segments_join(const char *list, const char *output);
+static const char *codec_resolve(const char *codec);
+static bool codec_probe(const char *codec);
+#ifdef USE_MPI
+static int distributed(void);
+static void domain_create(domain &d, const int rows, const int cols);
+static void domain_destroy(domain &d);
+static void domain_region(const domain &d, const int k, const bool halo,
+                          uint8_t **start, int *count, MPI_Datatype *type);
+static void domain_seed(domain &d, const uint64_t seed);
+static void domain_step(domain &d);
+#endif
+static void bench_report(FILE *out, const bench_result &r);
+static bench_result bench_run(const int rows, const int cols);
+static void bench_write_json(const char *path,
+                             const std::vector<bench_result> &results);
+static bool bench_history(const char *path,
+                          const std::vector<bench_result> &results);
+static int verify(void);
+static inline uint8_t verify_cell(const int i, const int j, const int rows,
+                                  const int cols, const uint64_t seed);
+static void verify_seed(engine &e, const uint64_t seed);
+static void verify_reference(const int rows, const int cols,
+                             const int generations, const uint64_t seed,
+                             std::vector<uint8_t> &frames,
+                             std::vector<population> &counts);
+static bool verify_run(const verify_case &c, const int rows, const int cols,
+                       const uint64_t seed, const std::vector<uint8_t> &frames,
+                       const std::vector<population> &counts);
+static void verify_describe(FILE *out, const verify_case &c, const int rows,
+                            const int cols);
+static tile_size autotune_tile(engine &e);
+static std::string rule_name(const automaton_rule &r);
+static FILE *stats_open(const char *path, const record_format format);
+static void stats_write(FILE *fp, const record_format format,
+                        const uint64_t generation, const engine &e,
+                        const population &p);
+static bool census_same(const population &a, const population &b);
+static void grid_pack(const engine &e, std::vector<uint8_t> &packed);
+static bool cycle_check(cycle_watch &w, const engine &e, const population &p,
+                        const size_t bytes);
+static void cycle_keep(cycle_watch &w, const cv::Mat &frame,
+                       const population &p);
+static inline bool cycle_looping(const cycle_watch &w);
+static size_t cycle_next(cycle_watch &w);
+static void cycle_report(const cycle_watch &w, const population &p,
+                         const uint64_t generation);
+static engine *checkpoint_load(const char *path, const engine_type type,
+                               uint64_t &generation, uint64_t &seed);
+static bool checkpoint_save(const engine &e, const char *path,
+                            const uint64_t generation, const uint64_t seed);
+static void handle_interrupt(int signal);
+static bool delta_decode(const uint8_t *src, const uint8_t *end,
+                         uint8_t *__restrict__ dst, const size_t n);
+#ifdef USE_TRACE
+static void trace_finish(void);
+static void trace_write(const char *path);
+#endif
+static bool varint_get(const uint8_t *&src, const uint8_t *end,
+                       uint64_t &value);
+static bool unpack_row(const uint8_t *__restrict__ packed,
+                       uint8_t *__restrict__ cells, const int cols,
+                       const int bits);
+static bool view_apply(const int rows, const int cols);
 static void display_progress(const int progress);
+static void encode_frames(frame_ring &ring, sink &out);
+static int cpu_package(const int cpu);
+static void pin_threads(const pin_policy policy);
+static void unpin_thread(void);
+static bool parse_counts(const char *arg, std::vector<int> &counts);
+static bool parse_sizes(const char *arg, std::vector<cv::Size> &sizes);
+static bool parse_viewport(const char *arg, cv::Rect &r, bool &placed);
+static frame_slot &ring_acquire(frame_ring &ring);
+static void ring_close(frame_ring &ring);
+static void palette_fill_density(void);
+static void arena_release(frame_arena &a);
+static void ring_create(frame_ring &ring, const int depth, const int rows,
+                        const int cols);
+static void ring_publish(frame_ring &ring);
+static void preview_create(preview_box &p, const int rows, const int cols);
+static void preview_offer(preview_box &p, const cv::Mat &cells);
+static void preview_close(preview_box &p);
+static void preview_frames(preview_box &p);
+static void preview_downsample(const cv::Mat &cells, cv::Mat &image,
+                               const int scale);
+static void preview_print(const cv::Mat &image);
 static error_t parse_opt(int key, char *arg, struct argp_state *state);
 
 //-----------------------------------------------------------------------------
 // ARGUMENT PARSER INITIALIZATION
 //-----------------------------------------------------------------------------
 
+// terminal receiving the progress bar (stderr when frames go to stdout)
+static FILE *console = stdout;
+
+// set once SIGINT or SIGTERM arrives while checkpointing
+static volatile sig_atomic_t interrupted = 0;
+
+// CPUs the program was allowed to run on, restored for the threads (such as
+// the encoder's) that are not pinned
+static cpu_set_t startup_cpus;
+// whether pin_threads() has pinned the simulation threads
+static bool pinned = false;
+
 static struct argp argp {
   .options = options, .parser = parse_opt, .args_doc = args_doc, .doc = doc,
   .children = NULL, .help_filter = NULL, .argp_domain = NULL
 };
 
+static struct argp job_argp {
+  .options = job_options, .parser = parse_opt, .args_doc = args_doc,
+  .doc = job_doc, .children = NULL, .help_filter = NULL, .argp_domain = NULL
+};
+
 //-----------------------------------------------------------------------------
 // FUNCTIONS
 //-----------------------------------------------------------------------------
@@ -120,122 +787,3015 @@ static struct argp argp {
  */
 int main(int argc, char **argv) {
   // variables used for video generation
-  int i, j;
-  int size;
-  cv::VideoWriter video;
-  cv::Mat f0, f1;
+  uint64_t generation = 0, generations, seed;
+  sink *out;
+  frame_ring ring;
+  preview_box preview;
+  std::thread previewer;
+  std::thread encoder;
+  engine *sim;
+  FILE *stats = NULL;
+  cycle_watch watch;
+
+#ifdef USE_MPI
+  int provided;
+
+  // only the main thread of each rank talks to MPI
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+#endif
 
   // set default argument values
-  args.frames = DEFAULT_FRAME_COUNT;
-  args.columns = DEFAULT_COLUMNS;
-  args.rows = DEFAULT_ROWS;
+  arguments_default(args);
 
   // parse arguments from argument vector
   argp_parse(&argp, argc, argv, 0, 0, &args);
 
-  // create video stream (receives bytes from input matrix)
-  video.open(
-    "automaton.avi", cv::VideoWriter::fourcc('F', 'F', 'V', '1'), 30.0,
-    cv::Size(args.columns, args.rows)
+#ifdef USE_TRACE
+  // spans are written out however the run ends
+  if (args.trace)
+    atexit(trace_finish);
+#endif
+
+  // keep stdout clean for the frames when streaming them
+  if (strcmp(args.output, "-") == 0 ||
+      (args.stats && strcmp(args.stats, "-") == 0))
+    console = stderr;
+
+  if (!rule_runs(args.engine, args.rule)) {
+    fprintf(stderr, "the %s engine only runs Brian's Brain\n",
+            ENGINE_NAMES[args.engine]);
+    return EXIT_FAILURE;
+  }
+
+  // pick the widest step kernel this machine supports
+  rule_apply();
+
+  // draw a seed unless the run has to be reproduced
+  if (!args.seeded) {
+    std::random_device device;
+    args.seed = (uint64_t)device() << 32 | device();
+  }
+
+  // the thread count decides the pinning too
+#ifdef _OPENMP
+  if (args.threads)
+    omp_set_num_threads(args.threads);
+#endif
+  schedule_apply();
+
+  // threads are pinned before the grids are first touched
+  pin_threads(args.pin);
+
+#ifdef USE_MPI
+  return distributed();
+#endif
+
+  if (args.bitrate && strcmp(args.codec, CODEC_FFV1) == 0) {
+    fprintf(stderr, "--bitrate needs a --codec encoded by ffmpeg\n");
+    return EXIT_FAILURE;
+  }
+
+  // hardware encoders are only known to work once they encoded a frame
+  if (strcmp(args.codec, CODEC_FFV1) != 0)
+    args.codec = codec_resolve(args.codec);
+
+  if (args.jobs && (args.encoders > 1 || args.checkpoint || args.resume ||
+                    args.stats || args.preview != PREVIEW_NONE)) {
+    fprintf(stderr, "--encoders, --checkpoint, --resume, --stats and "
+            "--preview are not available to --jobs\n");
+    return EXIT_FAILURE;
+  }
+  if ((args.viewport.width || args.scale > 1) && (args.replay || args.jobs)) {
+    fprintf(stderr, "--viewport and --scale are not available to --replay "
+            "and --jobs\n");
+    return EXIT_FAILURE;
+  }
+  if (args.on_cycle != CYCLE_IGNORE && (args.replay || args.encoders > 1)) {
+    fprintf(stderr, "--on-cycle is not available to --replay and "
+            "--encoders\n");
+    return EXIT_FAILURE;
+  }
+  if (args.on_cycle == CYCLE_REPEAT && args.checkpoint) {
+    fprintf(stderr, "repeated frames leave no generation to checkpoint\n");
+    return EXIT_FAILURE;
+  }
+  if (args.scale > 1 && args.scale_mode == SCALE_DENSITY &&
+      args.format == FORMAT_BBRAIN) {
+    fprintf(stderr, "densities cannot be recorded, only cell states\n");
+    return EXIT_FAILURE;
+  }
+
+  if (args.benchmark)
+    return benchmark();
+
+  if (args.verify)
+    return verify();
+
+  if (args.replay)
+    return replay();
+
+  if (args.jobs)
+    return batch();
+  if (args.encoders > 1 &&
+      (args.format != FORMAT_AVI && args.format != FORMAT_AVI_GRAY)) {
+    fprintf(stderr, "only videos (avi or avi-gray) are encoded in segments\n");
+    return EXIT_FAILURE;
+  }
+  if (args.encoders > 1 && (args.checkpoint || args.preview != PREVIEW_NONE)) {
+    fprintf(stderr, "--checkpoint and --preview need a single encoder\n");
+    return EXIT_FAILURE;
+  }
+
+  // simulation engine, either continuing a checkpoint or randomly seeded for
+  // interesting initialization
+  if (args.resume) {
+    sim = checkpoint_load(args.resume, args.engine, generation, seed);
+    args.rows = sim->rows();
+    args.columns = sim->cols();
+  } else {
+    sim = engine_create(args.engine, args.rows, args.columns);
+    if (sim == NULL)
+      return EXIT_FAILURE;
+    seed = args.seed;
+    seed_random(*sim, seed);
+  }
+
+  // frames show the viewport, a pixel per square of --scale cells
+  if (!view_apply(sim->rows(), sim->cols())) {
+    fprintf(stderr, "the viewport does not fit in the %dx%d grid\n",
+            sim->cols(), sim->rows());
+    return EXIT_FAILURE;
+  }
+  if (view.scale > 1 && view.mode == SCALE_DENSITY) {
+    // the vector lookups only hold as many colours as there are cell states
+    palette_row = palette_row_scalar;
+    palette_fill_density();
+  }
+
+  // segments of the video are encoded side by side instead
+  if (args.encoders > 1)
+    return segmented(sim, generation, seed);
+
+  // create output stream (receives bytes from the queued frames), leaving
+  // the threads of the codec free to run anywhere
+  unpin_thread();
+  out = sink_create(
+    args.format, args.output, view.height, view.width, args.queue_depth
   );
+  if (out == NULL)
+    return EXIT_FAILURE;
+  pin_threads(args.pin);
 
-  // video frame size initialization
-  f0 = cv::Mat(args.rows, args.columns, CV_8UC3);
-  f1 = cv::Mat(args.rows, args.columns, CV_8UC3);
+  // frames the simulation is colorized into
+  ring_create(ring, args.queue_depth, view.height, view.width);
 
-  // randomly seed frame for interesting initialization
-  std::srand(clock());
-  size = std::min(args.rows, args.columns) * DEFAULT_SEED_AREA;
+  // time the candidate traversal blocks on the seeded grid
+  tile = args.autotune ? autotune_tile(*sim) : args.tile;
 
-  for (i = (args.rows - size) / 2; i < (args.rows + size) / 2; i += 1)
-    for (j = (args.columns - size) / 2; j < (args.columns + size) / 2; j += 1)
-      f0.at<cv::Vec3b>(i, j) = std::rand() & 1 ? ON : OFF;
+  // every frame is frame_stride generations after the one before
+  generations = (uint64_t)args.frames * args.frame_stride;
 
   // hide cursor when printing progress
-  printf("\33[?25l");
+  fprintf(console, "\33[?25l");
+
+  // frames are encoded on their own thread while the next ones are simulated
+  encoder = std::thread(encode_frames, std::ref(ring), std::ref(*out));
+
+  // and shown at the preview's own pace
+  if (args.preview != PREVIEW_NONE) {
+    preview_create(preview, view.height, view.width);
+    previewer = std::thread(preview_frames, std::ref(preview));
+  }
+
+  // population of every frame, streamed as it is simulated
+  if (args.stats)
+    stats = stats_open(args.stats, args.stats_format);
+
+  // stop at the next generation (and save it) rather than lose the run
+  if (args.checkpoint) {
+    signal(SIGINT, handle_interrupt);
+    signal(SIGTERM, handle_interrupt);
+  }
+
+  for (; generation < generations && !interrupted;
+       generation += args.frame_stride) {
+    // once the frames of a cycle are kept, they stand in for the simulation
+    const bool looping = cycle_looping(watch);
+    const size_t k = looping ? cycle_next(watch) : 0;
+    population p;
 
-  for (i = 0; i < args.frames; i += 1) {
     // display progress bar
-    display_progress((i * 100) / args.frames);
-    // save current frame
-    if (i & 1)
-      video << f1;
-    else
-      video << f0;
+    display_progress((generation * 100) / generations);
+    // count the cells, and tell whether the frames started over
+    if (looping)
+      p = watch.counts[k];
+    else if (stats || args.on_cycle != CYCLE_IGNORE)
+      census_take(*sim, p);
+    if (args.on_cycle != CYCLE_IGNORE && !watch.found &&
+        cycle_check(watch, *sim, p, (size_t)view.height * view.width)) {
+      cycle_report(watch, p, generation);
+      if (args.on_cycle == CYCLE_STOP)
+        break;
+    }
+    // queue current frame for encoding
+    if (args.format != FORMAT_NONE) {
+      frame_slot &slot = ring_acquire(ring);
+      if (looping) {
+        watch.loop[k].copyTo(slot.frame);
+        slot.width = 0;
+      } else {
+        colorize(*sim, slot);
+      }
+      if (watch.repeat && !looping)
+        cycle_keep(watch, slot.frame, p);
+      if (args.preview != PREVIEW_NONE)
+        preview_offer(preview, slot.frame);
+      ring_publish(ring);
+    } else {
+      if (watch.repeat && !looping)
+        cycle_keep(watch, cv::Mat(), p);
+      // nothing is ever queued, so the first slot is free for the preview
+      // (which no longer changes once no frame is kept or simulated)
+      if (args.preview != PREVIEW_NONE && preview.wanted && !looping) {
+        colorize(*sim, ring.slots[0]);
+        preview_offer(preview, ring.slots[0].frame);
+      }
+    }
+    // record its population
+    if (stats)
+      stats_write(stats, args.stats_format, generation, *sim, p);
     // generate next frame
-    if (i & 1)
-      brain(f1, f0);
-    else
-      brain(f0, f1);
+    if (!looping)
+      sim->advance(args.frame_stride);
+    // save the new generation every so often
+    if (args.checkpoint &&
+        (generation + args.frame_stride) / args.checkpoint_interval !=
+          generation / args.checkpoint_interval)
+      checkpoint_save(
+        *sim, args.checkpoint, generation + args.frame_stride, seed
+      );
   }
 
-  // report that simulation generation is complete
-  printf("\33[2K\rCompleted generating the simulation! Enjoy!\n");
+  // save where the run stopped so it can be resumed from there
+  if (interrupted)
+    checkpoint_save(*sim, args.checkpoint, generation, seed);
+
+  // wait for the encoder to finish the queued frames
+  ring_close(ring);
+  encoder.join();
+  if (args.preview != PREVIEW_NONE) {
+    preview_close(preview);
+    previewer.join();
+  }
+
+  if (stats && stats != stdout)
+    fclose(stats);
+  else if (stats)
+    fflush(stats);
+
+  out->finish();
+  if (out->failed)
+    return EXIT_FAILURE;
+  delete out;
+  delete sim;
+  arena_release(pool);
+
+  // report that simulation generation is complete (or where it stopped)
+  if (interrupted)
+    fprintf(console, "\33[2K\rInterrupted at generation %llu, resume with "
+            "--resume %s\n", (unsigned long long)generation, args.checkpoint);
+  else
+    fprintf(console, "\33[2K\rCompleted generating the simulation (seed "
+            "%llu)! Enjoy!\n", (unsigned long long)seed);
 
   // re-enable cursor after program
-  printf("\33[?25h");
+  fprintf(console, "\33[?25h");
 
-  return EXIT_SUCCESS;
+  return interrupted ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
+#ifdef USE_MPI
 /**
- * @brief Model of Brian's Brain implemented as cleanly as possible.
+ * @brief Run the simulation on a block of the grid per MPI rank.
  *
- * @param in Previous frame of Brian's Brain.
- * @param out New, current frame of Brian's Brain.
+ * Raw frames are written collectively by all ranks into the output file, each
+ * rank filling its tile of every frame while the next generation is computed.
+ *
+ * @return int Exit status of the rank.
  */
-static void brain(const cv::Mat &__restrict__ in, cv::Mat &__restrict__ out) {
-  int i, j, k, l;
-  int tot;
+static int distributed(void) {
+  const uint8_t *palette = NULL;
+  int channels = 1;
+  domain d;
+  MPI_File fh;
+  MPI_Datatype tiles;
+  MPI_Request written = MPI_REQUEST_NULL;
+  std::vector<uint8_t> pixels[2];
+  int rank;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  // tiles of the frames are written concurrently at known offsets
+  if (args.format == FORMAT_RGB24) {
+    palette = palette_rgb[0].val;
+    channels = 3;
+  } else if (args.format == FORMAT_GRAY8) {
+    palette = palette_gray;
+    channels = 1;
+  } else if (args.format != FORMAT_CELLS) {
+    if (rank == 0)
+      fprintf(stderr, "distributed runs write raw frames only (rgb24, gray8 "
+              "or cells)\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  if (args.viewport.width || args.scale > 1) {
+    if (rank == 0)
+      fprintf(stderr, "distributed runs write every cell of the grid\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  if (args.on_cycle != CYCLE_IGNORE) {
+    if (rank == 0)
+      fprintf(stderr, "distributed runs do not watch for cycles\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
 
+  // every rank must seed its block from the same seed
+  MPI_Bcast(&args.seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+
+  domain_create(d, args.rows, args.columns);
+  domain_seed(d, args.seed);
+
+  if (MPI_File_open(d.comm, args.output, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                    MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+    if (d.rank == 0)
+      fprintf(stderr, "unable to open output: %s\n", args.output);
+    MPI_Abort(d.comm, EXIT_FAILURE);
+  }
+  MPI_File_set_size(fh, 0);
+
+  // the file is viewed as a sequence of frames, each rank seeing its tile
+  const int sizes[2] = {d.rows, d.cols * channels};
+  const int subsizes[2] = {d.cur.rows, d.cur.cols * channels};
+  const int starts[2] = {d.row0, d.col0 * channels};
+  const size_t tile_bytes = (size_t)subsizes[0] * subsizes[1];
+
+  MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_BYTE,
+                           &tiles);
+  MPI_Type_commit(&tiles);
+  MPI_File_set_view(fh, 0, MPI_BYTE, tiles, "native", MPI_INFO_NULL);
+  pixels[0].resize(tile_bytes);
+  pixels[1].resize(tile_bytes);
+
+  if (d.rank == 0)
+    fprintf(console, "\33[?25l");
+
+  for (int i = 0; i < args.frames; i += 1) {
+    std::vector<uint8_t> &block = pixels[i & 1];
+
+    if (d.rank == 0)
+      display_progress((i * 100) / args.frames);
+
+    // map the block into the buffer the write before last has released
 #pragma omp parallel for
-  for (i = 0; i < in.rows; i += 1)
-    for (j = 0; j < in.cols; j += 1)
-      if (in.at<cv::Vec3b>(i, j) == ON)
-        out.at<cv::Vec3b>(i, j) = DYING;
-      else if (in.at<cv::Vec3b>(i, j) == DYING)
-        out.at<cv::Vec3b>(i, j) = OFF;
-      else {
-        // search Moore neighborhood for live cells
-        for (tot = 0, k = -1; k < 2; k += 1)
-          if (i + k >= 0 && i + k < in.rows)
-            for (l = -1; l < 2; l += 1)
-              if (j + l >= 0 && j + l < in.cols)
-                if (in.at<cv::Vec3b>(i + k, j + l) == ON)
-                  tot += 1;
-
-        // automaton rule dictates turning on only if two neighbor cells are on
-        out.at<cv::Vec3b>(i, j) = (tot == 2) ? ON : OFF;
-      }
+    for (int r = 0; r < d.cur.rows; r += 1) {
+      uint8_t *dst = block.data() + (size_t)r * subsizes[1];
+
+      if (palette)
+        palette_row(grid_row(d.cur, r), dst, d.cur.cols, palette, channels);
+      else
+        memcpy(dst, grid_row(d.cur, r), d.cur.cols);
+    }
+
+    // the previous frame has to be written before this one is started
+    MPI_Wait(&written, MPI_STATUS_IGNORE);
+    MPI_File_iwrite_at_all(fh, (MPI_Offset)i * tile_bytes, block.data(),
+                           tile_bytes, MPI_BYTE, &written);
+
+    for (int k = 0; k < args.frame_stride; k += 1)
+      domain_step(d);
+  }
+
+  MPI_Wait(&written, MPI_STATUS_IGNORE);
+  MPI_File_close(&fh);
+  MPI_Type_free(&tiles);
+  domain_destroy(d);
+
+  if (d.rank == 0) {
+    fprintf(console, "\33[2K\rCompleted generating the simulation (seed "
+            "%llu)! Enjoy!\n", (unsigned long long)args.seed);
+    fprintf(console, "\33[?25h");
+  }
+
+  MPI_Finalize();
+
+  return EXIT_SUCCESS;
 }
 
 /**
- * @brief Display progress bar of how much of generation has happened.
+ * @brief Split the grid into a block per rank of a 2D Cartesian communicator.
  *
- * @param progress Amount of progress.
+ * @param d Domain to set up.
+ * @param rows Number of rows in the whole grid.
+ * @param cols Number of columns in the whole grid.
  */
-static void display_progress(const int progress) {
-  if (progress < 0 || progress > MAX_PROGRESS)
-    return;
+static void domain_create(domain &d, const int rows, const int cols) {
+  int dims[2] = {0, 0}, periods[2] = {0, 0}, coords[2];
 
-  struct winsize sz;
-  int rsz_progress;
+  MPI_Comm_rank(MPI_COMM_WORLD, &d.rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &d.ranks);
+  MPI_Dims_create(d.ranks, 2, dims);
 
-  // get window size from tty
-  ioctl(STDOUT_FILENO, TIOCGWINSZ, &sz);
+  // the longer side of the grid is cut into more blocks
+  if ((rows < cols) != (dims[0] < dims[1]))
+    std::swap(dims[0], dims[1]);
+  if (dims[0] > rows || dims[1] > cols) {
+    if (d.rank == 0)
+      fprintf(stderr, "too many ranks for a %dx%d grid\n", cols, rows);
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
 
-  // resize progress to match new progress bar size
+  MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 1, &d.comm);
+  MPI_Comm_rank(d.comm, &d.rank);
+  MPI_Cart_coords(d.comm, d.rank, 2, coords);
+
+  d.rows = rows;
+  d.cols = cols;
+  d.row0 = (int)((int64_t)rows * coords[0] / dims[0]);
+  d.col0 = (int)((int64_t)cols * coords[1] / dims[1]);
+  if (!grid_create(d.cur, (int64_t)rows * (coords[0] + 1) / dims[0] - d.row0,
+                   (int64_t)cols * (coords[1] + 1) / dims[1] - d.col0) ||
+      !grid_create(d.next, d.cur.rows, d.cur.cols))
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+
+  // blocks past the edges of the grid do not exist, their halo stays off
+  for (int k = 0; k < HALO_DIRECTIONS; k += 1) {
+    int at[2] = {coords[0] + HALO[k][0], coords[1] + HALO[k][1]};
+
+    if (at[0] < 0 || at[0] >= dims[0] || at[1] < 0 || at[1] >= dims[1])
+      d.neighbor[k] = MPI_PROC_NULL;
+    else
+      MPI_Cart_rank(d.comm, at, &d.neighbor[k]);
+  }
+
+  MPI_Type_vector(d.cur.rows, 1, d.cur.stride, MPI_BYTE, &d.column);
+  MPI_Type_commit(&d.column);
+}
+
+/**
+ * @brief Release the blocks and the communicator of a domain.
+ *
+ * @param d Domain to release.
+ */
+static void domain_destroy(domain &d) {
+  MPI_Type_free(&d.column);
+  grid_destroy(d.cur);
+  grid_destroy(d.next);
+  MPI_Comm_free(&d.comm);
+}
+
+/**
+ * @brief Locate the cells of a block facing one of its neighbors.
+ *
+ * @param d Domain holding the block.
+ * @param k Direction of the neighbor (index into HALO).
+ * @param halo Whether to locate the halo cells received from the neighbor
+ * rather than the block's own cells sent to it.
+ * @param start Receives the first cell.
+ * @param count Receives the number of elements of type.
+ * @param type Receives the layout of the cells.
+ */
+static void domain_region(const domain &d, const int k, const bool halo,
+                          uint8_t **start, int *count, MPI_Datatype *type) {
+  const int rows = d.cur.rows, cols = d.cur.cols;
+  const int dr = HALO[k][0], dc = HALO[k][1];
+  const int i =
+    dr < 0 ? (halo ? -1 : 0) : dr > 0 ? (halo ? rows : rows - 1) : 0;
+  const int j =
+    dc < 0 ? (halo ? -1 : 0) : dc > 0 ? (halo ? cols : cols - 1) : 0;
+
+  *start = grid_row(d.cur, i) + j;
+  if (dr == 0) {
+    *count = 1;
+    *type = d.column;
+  } else {
+    *count = dc == 0 ? cols : 1;
+    *type = MPI_BYTE;
+  }
+}
+
+/**
+ * @brief Seed the block of a domain as if the whole grid were seeded.
+ *
+ * @param d Domain to seed (all cells off).
+ * @param seed Seed of the random number generator.
+ */
+static void domain_seed(domain &d, const uint64_t seed) {
+#pragma omp parallel for
+  for (int i = 0; i < d.cur.rows; i += 1)
+    seed_cells(grid_row(d.cur, i), d.row0 + i, d.col0, d.cur.cols, d.rows,
+               d.cols, seed);
+}
+
+/**
+ * @brief Advance the block of a domain by one generation.
+ *
+ * The halo is exchanged with the neighbors while the interior of the block,
+ * which does not depend on it, is computed. The cells along the edges of the
+ * block are computed once the halo has arrived.
+ *
+ * @param d Domain to advance.
+ */
+static void domain_step(domain &d) {
+  const int rows = d.cur.rows, cols = d.cur.cols;
+  MPI_Request requests[2 * HALO_DIRECTIONS];
+
+  for (int k = 0; k < HALO_DIRECTIONS; k += 1) {
+    MPI_Datatype type;
+    uint8_t *start;
+    int count;
+
+    // what a rank sends towards k arrives in its neighbor's opposite halo
+    domain_region(d, k, true, &start, &count, &type);
+    MPI_Irecv(start, count, type, d.neighbor[k], HALO_DIRECTIONS - 1 - k,
+              d.comm, &requests[2 * k]);
+    domain_region(d, k, false, &start, &count, &type);
+    MPI_Isend(start, count, type, d.neighbor[k], k, d.comm,
+              &requests[2 * k + 1]);
+  }
+
+  if (cols > 2) {
+#pragma omp parallel for
+    for (int i = 1; i < rows - 1; i += 1)
+      brain_row(
+        grid_row(d.cur, i - 1) + 1, grid_row(d.cur, i) + 1,
+        grid_row(d.cur, i + 1) + 1, grid_row(d.next, i) + 1, cols - 2
+      );
+  }
+
+  MPI_Waitall(2 * HALO_DIRECTIONS, requests, MPI_STATUSES_IGNORE);
+
+  // first and last row, then the first and last cell of the rows between
+#pragma omp parallel for
+  for (int i = 0; i < rows; i += 1) {
+    const uint8_t *up = grid_row(d.cur, i - 1), *mid = grid_row(d.cur, i);
+    const uint8_t *down = grid_row(d.cur, i + 1);
+    uint8_t *dst = grid_row(d.next, i);
+
+    if (i == 0 || i == rows - 1) {
+      brain_row(up, mid, down, dst, cols);
+    } else {
+      brain_row(up, mid, down, dst, 1);
+      if (cols > 1)
+        brain_row(up + cols - 1, mid + cols - 1, down + cols - 1,
+                  dst + cols - 1, 1);
+    }
+  }
+
+  std::swap(d.cur, d.next);
+}
+#endif
+
+/**
+ * @brief Run the simulations listed in the --jobs file side by side.
+ *
+ * Every process-wide setting (engine, rule, tile, schedule) is shared by the
+ * jobs, and so are the frame buffers, which are given back to the arena as
+ * each job ends and reused by the next ones.
+ *
+ * @return int Return code status of program.
+ */
+static int batch(void) {
+  std::vector<std::thread> workers;
+  job_queue q;
+
+  jobs_load(args.jobs, q.jobs);
+  if (q.jobs.empty())
+    return EXIT_SUCCESS;
+
+#ifdef _OPENMP
+  q.threads = omp_get_max_threads();
+#else
+  q.threads = 1;
+#endif
+  q.free = q.threads;
+  q.next = 0;
+  q.started = 0;
+  q.done = 0;
+
+  // time the candidate traversal blocks on a grid of the first job
+  if (args.autotune) {
+    engine *e = engine_create(
+      args.engine, q.jobs[0].rows, q.jobs[0].columns
+    );
+
+    if (e == NULL)
+      return EXIT_FAILURE;
+    seed_random(*e, q.jobs[0].seed);
+    tile = autotune_tile(*e);
+    delete e;
+  } else {
+    tile = args.tile;
+  }
+
+  for (int k = std::min((size_t)q.threads, q.jobs.size()); k > 0; k -= 1)
+    workers.push_back(std::thread(job_worker, std::ref(q)));
+  for (std::thread &worker : workers)
+    worker.join();
+
+  arena_release(pool);
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Read the jobs of a --jobs file.
+ *
+ * Lines are split into words as the shell would (without running commands),
+ * and blank lines and lines starting with # are skipped. Each job starts from
+ * the options given on the command line, drawing a seed of its own unless it
+ * gives one.
+ *
+ * @param path File listing one job per line.
+ * @param jobs Receives the jobs.
+ */
+static void jobs_load(const char *path, std::vector<arguments> &jobs) {
+  FILE *fp = fopen(path, "r");
+  std::random_device device;
+  char *line = NULL;
+  size_t capacity = 0;
+
+  if (fp == NULL) {
+    perror("unable to open jobs");
+    exit(EXIT_FAILURE);
+  }
+
+  for (int number = 1; getline(&line, &capacity, fp) >= 0; number += 1) {
+    // newlines are not allowed in the words
+    line[strcspn(line, "\r\n")] = '\0';
+    const char *start = line + strspn(line, " \t");
+    const std::string name = cv::format("%s:%d", path, number);
+    std::vector<char *> argv = {(char *)name.c_str()};
+    arguments job = args;
+    wordexp_t words;
+
+    if (*start == '\0' || *start == '#')
+      continue;
+
+    if (wordexp(start, &words, WRDE_NOCMD) != 0) {
+      fprintf(stderr, "%s: unable to split the job into options\n",
+              name.c_str());
+      exit(EXIT_FAILURE);
+    }
+    argv.insert(argv.end(), words.we_wordv, words.we_wordv + words.we_wordc);
+
+    // errors are reported against the line of the job
+    job.seeded = false;
+    job.output = NULL;
+    argp_parse(&job_argp, argv.size(), argv.data(), 0, 0, &job);
+
+    if (job.output == NULL) {
+      fprintf(stderr, "%s: every job needs its own --output\n", name.c_str());
+      exit(EXIT_FAILURE);
+    }
+    if (!job.seeded)
+      job.seed = (uint64_t)device() << 32 | device();
+
+    // the words are freed with the line's expansion
+    job.output = strdup(job.output);
+    wordfree(&words);
+    jobs.push_back(job);
+  }
+
+  free(line);
+  fclose(fp);
+}
+
+/**
+ * @brief Pick the number of threads a job of a batch is stepped by.
+ *
+ * @param job Job to run.
+ * @param threads Threads of the whole batch.
+ * @return int One thread per JOB_CELLS_PER_THREAD cells of the grid.
+ */
+static int job_threads(const arguments &job, const int threads) {
+  const size_t cells = (size_t)job.rows * job.columns;
+
+  return std::clamp((int)(cells / JOB_CELLS_PER_THREAD), 1, threads);
+}
+
+/**
+ * @brief Start the jobs of a batch, in order, while there are any left.
+ *
+ * @param q Jobs of the batch.
+ */
+static void job_worker(job_queue &q) {
+  std::unique_lock<std::mutex> guard(q.lock);
+
+  while (q.next < q.jobs.size()) {
+    const size_t k = q.next++;
+    const arguments &job = q.jobs[k];
+    const int need = job_threads(job, q.threads);
+
+    q.changed.wait(guard, [&] { return q.started == k && q.free >= need; });
+    q.started += 1;
+    q.free -= need;
+    q.changed.notify_all();
+
+    guard.unlock();
+    job_run(job, need);
+    guard.lock();
+
+    q.free += need;
+    q.done += 1;
+    fprintf(console, "Completed job %zu of %zu: %s (seed %llu)\n", q.done,
+            q.jobs.size(), job.output, (unsigned long long)job.seed);
+    fflush(console);
+    q.changed.notify_all();
+  }
+}
+
+/**
+ * @brief Simulate one job of a batch and write its frames.
+ *
+ * Frames are written by the job's own thread, which keeps encoding apart
+ * from the other jobs rather than behind a thread of its own.
+ *
+ * @param job Job to run.
+ * @param threads Threads the job's steps are shared by.
+ */
+static void job_run(const arguments &job, const int threads) {
+  cycle_watch watch;
+  frame_slot slot;
+  engine *sim;
+  sink *out;
+
+  // started from a pinned thread, but its teams are its own
+  unpin_thread();
+#ifdef _OPENMP
+  omp_set_num_threads(threads);
+#endif
+  schedule_apply();
+
+  sim = engine_create(args.engine, job.rows, job.columns);
+  out = sink_create(job.format, job.output, job.rows, job.columns, 1);
+  slot.frame = arena_frame(pool, job.rows, job.columns, 1);
+  slot.width = 0;
+  if (sim == NULL || out == NULL || slot.frame.empty())
+    exit(EXIT_FAILURE);
+  seed_random(*sim, job.seed);
+
+  for (int f = 0; f < job.frames; f += 1) {
+    const bool looping = cycle_looping(watch);
+    const size_t k = looping ? cycle_next(watch) : 0;
+    population p = EMPTY_POPULATION;
+
+    // jobs stop (or repeat themselves) quietly once their frames start over
+    if (args.on_cycle != CYCLE_IGNORE && !watch.found) {
+      census_take(*sim, p);
+      if (cycle_check(watch, *sim, p, (size_t)job.rows * job.columns) &&
+          args.on_cycle == CYCLE_STOP)
+        break;
+    }
+    if (!looping)
+      colorize(*sim, slot);
+    if (watch.repeat && !looping)
+      cycle_keep(watch, slot.frame, p);
+    {
+      TRACE_SPAN("encode");
+      out->write(looping ? watch.loop[k] : slot.frame);
+    }
+    if (out->failed)
+      exit(EXIT_FAILURE);
+    if (f + 1 < job.frames && !looping)
+      sim->advance(job.frame_stride);
+  }
+
+  out->finish();
+  if (out->failed)
+    exit(EXIT_FAILURE);
+  delete out;
+  delete sim;
+  arena_recycle(pool, slot.frame);
+  for (const cv::Mat &frame : watch.loop)
+    arena_recycle(pool, frame);
+}
+
+/**
+ * @brief Export the frames of a recording to the output format.
+ *
+ * The recording is mapped and its index used to start decoding at the key
+ * frame before the first frame exported, so seeking into a long recording
+ * only decodes up to a key frame interval of frames that are not exported.
+ * Frames are queued for the encoder thread just as simulated ones are.
+ *
+ * @return int Return code status of program.
+ */
+static int replay(void) {
+  recording_header header;
+  recording_trailer trailer;
+  struct stat st;
+  uint64_t first, last;
+  size_t stride, bytes;
+  frame_ring ring;
+  std::thread encoder;
+  uint8_t *map;
+  sink *out;
+  int fd;
+
+  fd = open(args.replay, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror("unable to open recording");
+    exit(EXIT_FAILURE);
+  }
+  if ((size_t)st.st_size < sizeof(header) + sizeof(trailer)) {
+    fprintf(stderr, "not a recording: %s\n", args.replay);
+    exit(EXIT_FAILURE);
+  }
+
+  map = (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror("unable to map recording");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(&header, map, sizeof(header));
+  memcpy(&trailer, map + st.st_size - sizeof(trailer), sizeof(trailer));
+
+  // reject anything but a complete recording of a grid this program can hold
+  if (memcmp(header.magic, RECORDING_MAGIC, sizeof(header.magic)) != 0 ||
+      memcmp(trailer.magic, RECORDING_MAGIC, sizeof(trailer.magic)) != 0 ||
+      header.version == 0 || header.version > RECORDING_VERSION ||
+      (header.bits != CHECKPOINT_BITS &&
+       header.bits != CHECKPOINT_WIDE_BITS) ||
+      header.states < 2 || header.states > (1u << header.bits) ||
+      header.rows == 0 || header.cols == 0 || header.rows > MAX_GRID_SIZE ||
+      header.cols > MAX_GRID_SIZE || header.keyframe_interval == 0 ||
+      trailer.index < sizeof(header) ||
+      trailer.index > (uint64_t)st.st_size - sizeof(trailer) ||
+      trailer.frames > (uint64_t)st.st_size ||
+      st.st_size - sizeof(trailer) - trailer.index !=
+        trailer.frames * sizeof(uint64_t)) {
+    fprintf(stderr, "not a recording: %s\n", args.replay);
+    exit(EXIT_FAILURE);
+  }
+
+  first = args.replay_from;
+  if (first >= trailer.frames) {
+    fprintf(stderr, "%s holds only %llu frames\n", args.replay,
+            (unsigned long long)trailer.frames);
+    exit(EXIT_FAILURE);
+  }
+  last = args.framed ? std::min(trailer.frames, first + args.frames)
+                     : trailer.frames;
+
+  // frames are colored as the rule that was recorded
+  args.rows = header.rows;
+  args.columns = header.cols;
+  cell_states = header.states;
+  palette_fill(cell_states);
+
+  stride = tile_count(header.cols, 8 / header.bits);
+  bytes = stride * header.rows;
+  std::vector<uint8_t> packed(bytes);
+
+  unpin_thread();
+  out = sink_create(
+    args.format, args.output, args.rows, args.columns, args.queue_depth
+  );
+  if (out == NULL)
+    return EXIT_FAILURE;
+  pin_threads(args.pin);
+  ring_create(ring, args.queue_depth, args.rows, args.columns);
+
+  fprintf(console, "\33[?25l");
+  encoder = std::thread(encode_frames, std::ref(ring), std::ref(*out));
+
+  // decoding starts from the key frame at or before the first frame
+  for (uint64_t k = first - first % header.keyframe_interval; k < last;
+       k += 1) {
+    uint64_t offset;
+    bool bad = false;
+
+    memcpy(&offset, map + trailer.index + k * sizeof(offset), sizeof(offset));
+    if (k % header.keyframe_interval == 0)
+      memset(packed.data(), 0, bytes);
+    if (offset < sizeof(header) || offset >= trailer.index ||
+        !delta_decode(map + offset, map + trailer.index, packed.data(),
+                      bytes)) {
+      fprintf(stderr, "corrupt recording: %s\n", args.replay);
+      exit(EXIT_FAILURE);
+    }
+    if (k < first)
+      continue;
+
+    display_progress(((k - first) * 100) / (last - first));
+    frame_slot &slot = ring_acquire(ring);
+
+#pragma omp parallel for reduction(| : bad)
+    for (int i = 0; i < args.rows; i += 1)
+      bad |= !unpack_row(packed.data() + i * stride,
+                         slot.frame.ptr<uint8_t>(i), args.columns,
+                         header.bits);
+    if (bad) {
+      fprintf(stderr, "corrupt recording: %s\n", args.replay);
+      exit(EXIT_FAILURE);
+    }
+    ring_publish(ring);
+  }
+
+  ring_close(ring);
+  encoder.join();
+
+  out->finish();
+  if (out->failed)
+    return EXIT_FAILURE;
+  delete out;
+  munmap(map, st.st_size);
+  arena_release(pool);
+
+  fprintf(console, "\33[2K\rCompleted replaying %llu frames of %s!\n",
+          (unsigned long long)(last - first), args.replay);
+  fprintf(console, "\33[?25h");
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Encode the video as segments on several writers at once.
+ *
+ * Each segment is encoded by an encoder process of its own into a file of its
+ * own, so each one starts on a key frame whatever the --codec. The engine
+ * given scouts ahead, handing each writer a copy of the generation its next
+ * segment starts at (and writing the statistics of every frame), while the
+ * writers simulate and encode their segments concurrently. The segments
+ * are listed in an ffconcat file and, unless --keep-segments is given, copied
+ * into the output by ffmpeg.
+ *
+ * @param sim Engine holding the first generation to encode (deleted here).
+ * @param generation Generation held by the engine.
+ * @param seed Seed of the random initialization of the run.
+ * @return int Return code status of program.
+ */
+static int segmented(engine *sim, uint64_t generation, const uint64_t seed) {
+  const uint64_t generations = (uint64_t)args.frames * args.frame_stride;
+  const int total = (generations - std::min(generation, generations) +
+                     args.frame_stride - 1) / args.frame_stride;
+  const bool gray = args.format == FORMAT_AVI_GRAY;
+  std::vector<segment_writer> writers(args.encoders);
+  std::vector<std::string> paths;
+  std::vector<uint8_t> row(args.columns);
+  std::atomic<int> encoded(0);
+  std::string list = args.output;
+  FILE *stats = NULL;
+  FILE *fp;
+  bool joined = false;
+
+  // the writers split the threads between them
+#ifdef _OPENMP
+  const int threads = std::max(1, omp_get_max_threads() / args.encoders);
+#else
+  const int threads = 1;
+#endif
+
+  tile = args.autotune ? autotune_tile(*sim) : args.tile;
+
+  for (segment_writer &w : writers) {
+    w.sim = engine_create(args.engine, args.rows, args.columns);
+    w.out = NULL;
+    w.slot.frame = arena_frame(pool, view.height, view.width, 1);
+    w.slot.width = 0;
+    w.threads = threads;
+    if (w.sim == NULL || w.slot.frame.empty())
+      return EXIT_FAILURE;
+  }
+
+  if (args.stats)
+    stats = stats_open(args.stats, args.stats_format);
+
+  fprintf(console, "\33[?25l");
+
+  for (int k = 0, done = 0; done < total; k += 1) {
+    segment_writer &w = writers[k % writers.size()];
+
+    display_progress(encoded * 100 / std::max(total, 1));
+
+    // the writer has to finish its previous segment first
+    if (w.worker.joinable())
+      w.worker.join();
+
+    w.frames = std::min(args.segment_frames, total - done);
+    for (int i = 0; i < args.rows; i += 1) {
+      sim->read_row(i, row.data());
+      w.sim->write_row(i, row.data());
+    }
+
+    // sinks are only made here so that the arena is never used concurrently
+    paths.push_back(segment_path(args.output, k));
+    if (w.out == NULL) {
+      unpin_thread();
+      w.out = new video_sink(
+        paths.back().c_str(), view.height, view.width,
+        gray ? palette_gray : palette_bgr[0].val, gray ? 1 : 3
+      );
+      pin_threads(args.pin);
+    } else {
+      w.out->open(paths.back().c_str());
+    }
+    if (w.out->failed)
+      exit(EXIT_FAILURE);
+    w.worker = std::thread(segment_encode, std::ref(w), std::ref(encoded));
+
+    // skip to the start of the next segment
+    for (int f = 0; f < w.frames; f += 1, generation += args.frame_stride) {
+      if (stats) {
+        population p;
+
+        census_take(*sim, p);
+        stats_write(stats, args.stats_format, generation, *sim, p);
+      }
+      if (done + f + 1 < total)
+        sim->advance(args.frame_stride);
+    }
+    done += w.frames;
+  }
+
+  // deleting the sinks finishes the last videos
+  for (segment_writer &w : writers) {
+    if (w.worker.joinable())
+      w.worker.join();
+    display_progress(encoded * 100 / std::max(total, 1));
+    if (w.out)
+      w.out->finish();
+    if (w.out && w.out->failed)
+      return EXIT_FAILURE;
+    delete w.out;
+    delete w.sim;
+  }
+  delete sim;
+  arena_release(pool);
+
+  if (stats && stats != stdout)
+    fclose(stats);
+  else if (stats)
+    fflush(stats);
+
+  // the list names the segments relative to its own directory
+  if (list.size() > 4 && list.compare(list.size() - 4, 4, ".avi") == 0)
+    list.resize(list.size() - 4);
+  list += SEGMENT_LIST_EXTENSION;
+  fp = fopen(list.c_str(), "w");
+  if (fp == NULL) {
+    perror("unable to write segment list");
+    exit(EXIT_FAILURE);
+  }
+  fprintf(fp, "ffconcat version 1.0\n");
+  for (const std::string &path : paths) {
+    const size_t slash = path.rfind('/');
+
+    fprintf(fp, "file '%s'\n",
+            path.c_str() + (slash == std::string::npos ? 0 : slash + 1));
+  }
+  fclose(fp);
+
+  if (!args.keep_segments && segments_join(list.c_str(), args.output)) {
+    for (const std::string &path : paths)
+      unlink(path.c_str());
+    unlink(list.c_str());
+    joined = true;
+  }
+
+  if (joined)
+    fprintf(console, "\33[2K\rCompleted generating the simulation (seed "
+            "%llu)! Enjoy!\n", (unsigned long long)seed);
+  else
+    fprintf(console, "\33[2K\rCompleted generating the simulation (seed "
+            "%llu) as %zu segments listed in %s\n", (unsigned long long)seed,
+            paths.size(), list.c_str());
+  fprintf(console, "\33[?25h");
+
+  return args.keep_segments || joined ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * @brief Simulate and encode the segment handed to a writer.
+ *
+ * @param w Writer holding the first generation of the segment.
+ * @param encoded Frames encoded by all writers so far.
+ */
+static void segment_encode(segment_writer &w, std::atomic<int> &encoded) {
+  // started from a pinned thread, but its teams are its own
+  unpin_thread();
+#ifdef _OPENMP
+  omp_set_num_threads(w.threads);
+#endif
+  schedule_apply();
+
+  for (int f = 0; f < w.frames; f += 1) {
+    colorize(*w.sim, w.slot);
+    {
+      TRACE_SPAN("encode");
+      w.out->write(w.slot.frame);
+    }
+    if (w.out->failed)
+      exit(EXIT_FAILURE);
+    if (f + 1 < w.frames)
+      w.sim->advance(args.frame_stride);
+    encoded += 1;
+  }
+}
+
+/**
+ * @brief Name the file a segment of the output is encoded into.
+ *
+ * @param output Video the segments make up.
+ * @param k Index of the segment.
+ * @return std::string Output with the index inserted before its extension.
+ */
+static std::string segment_path(const char *output, const int k) {
+  std::string path = output;
+  const char *extension = ".avi";
+
+  if (path.size() > 4 && path.compare(path.size() - 4, 4, ".avi") == 0)
+    path.resize(path.size() - 4);
+
+  return path + cv::format("-%04d", k) + extension;
+}
+
+/**
+ * @brief Copy the segments of a list into one video with ffmpeg.
+ *
+ * The streams are copied as they are, so joining costs no more than reading
+ * and writing the segments once.
+ *
+ * @param list ffconcat list of the segments.
+ * @param output Video to write.
+ * @return bool Whether ffmpeg could be run and succeeded.
+ */
+static bool segments_join(const char *list, const char *output) {
+  const char *argv[] = {
+    "ffmpeg", "-v", "error", "-y", "-f", "concat", "-safe", "0", "-i", list,
+    "-c", "copy", output, NULL
+  };
+  pid_t pid;
+  int status;
+
+  if (posix_spawnp(&pid, "ffmpeg", NULL, NULL, (char *const *)argv,
+                   environ) != 0) {
+    fprintf(stderr, "unable to run ffmpeg, segments left in %s\n", list);
+    return false;
+  }
+
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "ffmpeg could not join the segments listed in %s\n",
+            list);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Pick the codec the videos are encoded with.
+ *
+ * @param codec Codec of --codec (an ffmpeg encoder or auto).
+ * @return const char* The codec if ffmpeg can encode with it, the first
+ * candidate that works for auto, or else CODEC_FFV1.
+ */
+static const char *codec_resolve(const char *codec) {
+  static const char *const candidates[] = CODEC_CANDIDATES;
+
+  if (strcmp(codec, "auto") != 0 && codec_probe(codec))
+    return codec;
+  if (strcmp(codec, "auto") == 0)
+    for (const char *candidate : candidates)
+      if (codec_probe(candidate))
+        return candidate;
+
+  fprintf(stderr, "%s is not available, encoding with %s instead\n",
+          strcmp(codec, "auto") == 0 ? "no hardware encoder" : codec,
+          CODEC_FFV1);
+  return CODEC_FFV1;
+}
+
+/**
+ * @brief Check whether ffmpeg can encode with a codec on this machine.
+ *
+ * Builds of ffmpeg list their hardware encoders whether or not the machine
+ * has the device, so a blank frame is actually encoded (and dropped).
+ *
+ * @param codec ffmpeg encoder to try.
+ * @return bool Whether ffmpeg could be run and encoded the frame.
+ */
+static bool codec_probe(const char *codec) {
+  std::vector<const char *> argv = {
+    "ffmpeg", "-v", "quiet", "-nostdin", "-f", "lavfi", "-i",
+    "color=black:size=256x256", "-frames:v", "1"
+  };
+  pid_t pid;
+  int status;
+
+  codec_options(codec, argv);
+  argv.insert(argv.end(), {"-f", "null", "-", NULL});
+
+  if (posix_spawnp(&pid, "ffmpeg", NULL, NULL, (char *const *)argv.data(),
+                   environ) != 0)
+    return false;
+
+  return waitpid(pid, &status, 0) >= 0 && WIFEXITED(status) &&
+         WEXITSTATUS(status) == 0;
+}
+
+/**
+ * @brief Benchmark every requested resolution and thread count.
+ *
+ * @return int Return code status of program.
+ */
+static int benchmark(void) {
+  std::vector<cv::Size> sizes;
+  std::vector<int> threads;
+  std::vector<bench_result> results;
+
+  // benchmark the configured frame size on all threads by default
+  if (args.bench_sizes)
+    parse_sizes(args.bench_sizes, sizes);
+  else
+    sizes.push_back(cv::Size(args.columns, args.rows));
+
+  if (args.bench_threads)
+    parse_counts(args.bench_threads, threads);
+  else
+#ifdef _OPENMP
+    threads.push_back(omp_get_max_threads());
+#else
+    threads.push_back(1);
+#endif
+
+  for (cv::Size size : sizes)
+    for (int t : threads) {
+#ifdef _OPENMP
+      omp_set_num_threads(t);
+#endif
+      results.push_back(bench_run(size.height, size.width));
+      results.back().threads = t;
+      bench_report(console, results.back());
+    }
+
+  if (args.bench_json)
+    bench_write_json(args.bench_json, results);
+
+  // a slower build fails, though its timings are still recorded
+  if (args.bench_history && !bench_history(args.bench_history, results))
+    return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Time each stage of the pipeline for one frame size.
+ *
+ * Stages run one after the other on the calling thread (apart from their own
+ * parallel loops) so that each one is timed on its own. Encoded video goes to
+ * a temporary file that is removed straight away, raw frames to /dev/null.
+ *
+ * @param rows Number of rows in the grid.
+ * @param cols Number of columns in the grid.
+ * @return bench_result Timings of the stages (threads left unset).
+ */
+static bench_result bench_run(const int rows, const int cols) {
+  const double cells = (double)rows * cols * args.frames;
+  char path[] = BENCH_VIDEO_TEMPLATE;
+  bench_result r = {};
+  frame_slot slot;
+  engine *sim;
+  sink *out;
+
+  unpin_thread();
+  if (args.format == FORMAT_AVI || args.format == FORMAT_AVI_GRAY) {
+    int fd = mkstemps(path, strlen(".avi"));
+
+    if (fd < 0) {
+      perror("unable to create temporary video");
+      exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    out = sink_create(args.format, path, rows, cols, 1);
+    unlink(path);
+  } else {
+    out = sink_create(args.format, "/dev/null", rows, cols, 1);
+  }
+  if (out == NULL)
+    exit(EXIT_FAILURE);
+
+  // the thread count may have changed since the last run
+  pin_threads(args.pin);
+
+  sim = engine_create(args.engine, rows, cols);
+  slot.frame = arena_frame(pool, rows, cols, 1);
+  slot.width = 0;
+  if (sim == NULL || slot.frame.empty())
+    exit(EXIT_FAILURE);
+
+  seed_random(*sim, args.seed);
+  tile = args.autotune ? autotune_tile(*sim) : args.tile;
+  r.buffers = pool.allocations;
+
+  for (int i = 0; i < args.frames; i += 1) {
+    double start = seconds();
+    colorize(*sim, slot);
+    double colorized = seconds();
+    out->write(slot.frame);
+    if (out->failed)
+      exit(EXIT_FAILURE);
+    double encoded = seconds();
+    sim->step();
+    double stepped = seconds();
+
+    r.colorize += colorized - start;
+    r.encode += encoded - colorized;
+    r.step += stepped - encoded;
+  }
+
+  // a step reads one generation and writes the next
+  r.bandwidth = 2.0 * sim->footprint() * args.frames / r.step;
+  r.fps = args.frames / (r.colorize + r.encode + r.step);
+  r.step *= 1e9 / cells;
+  r.colorize *= 1e9 / cells;
+  r.encode *= 1e9 / cells;
+  r.allocations = pool.allocations - r.buffers;
+
+  r.rows = rows;
+  r.cols = cols;
+  r.tile = tile;
+  if (args.engine == ENGINE_BYTE)
+    r.kernel = SIMD_NAMES[resolve_isa(args.simd)];
+  else if (args.engine == ENGINE_HASHLIFE)
+    r.kernel = "memoized";
+  else
+    r.kernel = "bitwise";
+
+  delete out;
+  delete sim;
+  arena_release(pool);
+
+  return r;
+}
+
+/**
+ * @brief Print the timings of a benchmarked configuration.
+ *
+ * @param out Stream receiving the report.
+ * @param r Timings to print.
+ */
+static void bench_report(FILE *out, const bench_result &r) {
+  fprintf(
+    out, "%s engine (%s), %dx%d, %d thread%s, tile %dx%d, %d generations\n",
+    ENGINE_NAMES[args.engine], r.kernel, r.cols, r.rows, r.threads,
+    r.threads == 1 ? "" : "s", r.tile.rows, r.tile.cols ? r.tile.cols : r.cols,
+    args.frames
+  );
+  fprintf(
+    out, "  step      %8.3f ns/cell  %8.2f GB/s\n", r.step, r.bandwidth / 1e9
+  );
+  fprintf(out, "  colorize  %8.3f ns/cell\n", r.colorize);
+  fprintf(out, "  encode    %8.3f ns/cell  (%s)\n", r.encode,
+          FORMAT_NAMES[args.format]);
+  fprintf(out, "  overall   %8.1f frames/s\n", r.fps);
+  fprintf(
+    out, "  buffers   %8zu pooled     %8zu allocated while running\n",
+    r.buffers, r.allocations
+  );
+}
+
+/**
+ * @brief Write the benchmark results as JSON.
+ *
+ * @param path File receiving the results ("-" for stdout).
+ * @param results Timings of every benchmarked configuration.
+ */
+static void bench_write_json(const char *path,
+                             const std::vector<bench_result> &results) {
+  FILE *fp = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+
+  if (fp == NULL) {
+    perror("unable to write benchmark results");
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(
+    fp, "{\n  \"engine\": \"%s\",\n  \"format\": \"%s\",\n",
+    ENGINE_NAMES[args.engine], FORMAT_NAMES[args.format]
+  );
+  fprintf(fp, "  \"generations\": %d,\n  \"results\": [", args.frames);
+
+  for (size_t k = 0; k < results.size(); k += 1) {
+    const bench_result &r = results[k];
+
+    fprintf(
+      fp,
+      "%s\n    {\"columns\": %d, \"rows\": %d, \"threads\": %d, "
+      "\"kernel\": \"%s\", \"tile_rows\": %d, \"tile_columns\": %d, "
+      "\"step_ns_per_cell\": %.4f, \"colorize_ns_per_cell\": %.4f, "
+      "\"encode_ns_per_cell\": %.4f, \"frames_per_second\": %.2f, "
+      "\"step_bytes_per_second\": %.0f, \"frame_buffers\": %zu, "
+      "\"frame_allocations\": %zu}",
+      k ? "," : "", r.cols, r.rows, r.threads, r.kernel, r.tile.rows,
+      r.tile.cols ? r.tile.cols : r.cols, r.step, r.colorize, r.encode, r.fps,
+      r.bandwidth, r.buffers, r.allocations
+    );
+  }
+
+  fprintf(fp, "\n  ]\n}\n");
+
+  if (fp != stdout)
+    fclose(fp);
+}
+
+/**
+ * @brief Compare benchmark results with the runs recorded before them.
+ *
+ * The history holds one JSON object per line and run of a configuration
+ * (host, engine, kernel, format, size, threads and generations), so runs on
+ * other machines sharing it are never compared. A configuration got slower if
+ * its frame rate fell more than --bench-tolerance percent below the median of
+ * its last BENCH_HISTORY_RUNS recorded runs, which a single lucky run cannot
+ * raise. The results are then appended to the history, which starts with the
+ * first run.
+ *
+ * @param path File holding the history.
+ * @param results Timings of every benchmarked configuration.
+ * @return bool Whether no configuration got slower.
+ */
+static bool bench_history(const char *path,
+                          const std::vector<bench_result> &results) {
+  const char *format = FORMAT_NAMES[args.format];
+  std::vector<std::vector<double>> rates(results.size());
+  const double kept = 1 - args.bench_tolerance / 100.0;
+  bool faster = true;
+  char host[64] = "unknown";
+  char line[512];
+  FILE *fp;
+
+  gethostname(host, sizeof(host) - 1);
+
+  // frame rates recorded for each configuration on this host, oldest first
+  fp = fopen(path, "r");
+  while (fp && fgets(line, sizeof(line), fp)) {
+    char machine[64], engine[16], kernel[16], container[16];
+    int cols, rows, threads, generations;
+    double fps;
+
+    if (sscanf(line, "{\"host\":\"%63[^\"]\",\"engine\":\"%15[^\"]\","
+               "\"kernel\":\"%15[^\"]\",\"format\":\"%15[^\"]\","
+               "\"columns\":%d,\"rows\":%d,\"threads\":%d,"
+               "\"generations\":%d,\"frames_per_second\":%lf", machine,
+               engine, kernel, container, &cols, &rows, &threads,
+               &generations, &fps) != 9 ||
+        strcmp(machine, host) != 0)
+      continue;
+
+    for (size_t k = 0; k < results.size(); k += 1) {
+      const bench_result &r = results[k];
+
+      if (strcmp(engine, ENGINE_NAMES[args.engine]) == 0 &&
+          strcmp(kernel, r.kernel) == 0 && strcmp(container, format) == 0 &&
+          cols == r.cols && rows == r.rows && threads == r.threads &&
+          generations == args.frames)
+        rates[k].push_back(fps);
+    }
+  }
+  if (fp)
+    fclose(fp);
+
+  for (size_t k = 0; k < results.size(); k += 1) {
+    const bench_result &r = results[k];
+    const size_t n = std::min(rates[k].size(), (size_t)BENCH_HISTORY_RUNS);
+    std::vector<double> last(rates[k].end() - n, rates[k].end());
+    double median;
+
+    if (n == 0)
+      continue;
+
+    // the mean of the middle two when there is an even number of runs
+    std::sort(last.begin(), last.end());
+    median = (last[(n - 1) / 2] + last[n / 2]) / 2;
+
+    if (r.fps < median * kept) {
+      fprintf(stderr, "%s engine (%s), %dx%d, %d thread%s got slower: %.1f "
+              "frames/s, %.1f%% below the median of its last %zu runs on %s "
+              "(%.1f frames/s)\n", ENGINE_NAMES[args.engine], r.kernel,
+              r.cols, r.rows, r.threads, r.threads == 1 ? "" : "s", r.fps,
+              100 * (1 - r.fps / median), n, host, median);
+      faster = false;
+    }
+  }
+
+  fp = fopen(path, "a");
+  if (fp == NULL) {
+    perror("unable to record benchmark history");
+    exit(EXIT_FAILURE);
+  }
+
+  for (const bench_result &r : results)
+    fprintf(fp, "{\"host\":\"%s\",\"engine\":\"%s\",\"kernel\":\"%s\","
+            "\"format\":\"%s\",\"columns\":%d,\"rows\":%d,\"threads\":%d,"
+            "\"generations\":%d,\"frames_per_second\":%.2f,"
+            "\"step_ns_per_cell\":%.4f,\"time\":%lld}\n", host,
+            ENGINE_NAMES[args.engine], r.kernel, format, r.cols, r.rows,
+            r.threads, args.frames, r.fps, r.step, (long long)time(NULL));
+
+  fclose(fp);
+
+  return faster;
+}
+
+/**
+ * @brief Check every engine against the reference, bit for bit.
+ *
+ * Each grid is stepped by the reference (see verify_reference()), then by
+ * the byte engine with each distinct step kernel this machine supports and
+ * by every other engine running the rule, on each thread count, with the
+ * configured tile and a small odd one, and a generation or VERIFY_STRIDE
+ * generations at a time. Every frame of every run has to match the
+ * reference's, cell for cell, and so do their populations, which the byte
+ * engine counts (and hashes, as for --on-cycle) while it steps.
+ *
+ * @return int Return code status of program.
+ */
+static int verify(void) {
+  const uint64_t seed = args.seeded ? args.seed : VERIFY_SEED;
+  const int generations = args.framed ? args.frames : VERIFY_GENERATIONS;
+  const tile_size tiles[] = {
+    args.autotune ? tile_size{DEFAULT_TILE_ROWS, DEFAULT_TILE_COLS} : args.tile,
+    {VERIFY_TILE_ROWS, VERIFY_TILE_COLS},
+  };
+  std::vector<verify_case> cases;
+  std::vector<row_kernel> kernels;
+  std::vector<cv::Size> sizes;
+  std::vector<int> threads;
+  int runs = 0, failures = 0;
+
+  parse_sizes(args.bench_sizes ? args.bench_sizes : VERIFY_SIZES, sizes);
+
+  // an odd count besides one thread and all of them by default
+  if (args.bench_threads) {
+    parse_counts(args.bench_threads, threads);
+  } else {
+#ifdef _OPENMP
+    const int all = omp_get_max_threads();
+#else
+    const int all = 1;
+#endif
+    threads = {1, 3};
+    if (all != 1 && all != 3)
+      threads.push_back(all);
+  }
+
+  // the byte engine with each kernel, then the others with the widest one
+  for (simd_isa isa : {SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512, SIMD_NEON}) {
+    if (!simd_supported(isa))
+      continue;
+
+    const row_kernel k = select_rule_kernel(args.rule, isa);
+    bool seen = false;
+
+    for (row_kernel other : kernels)
+      seen |= other == k;
+    if (!seen) {
+      kernels.push_back(k);
+      cases.push_back({ENGINE_BYTE, isa, 0, {}, 0});
+    }
+  }
+  for (engine_type type : {ENGINE_BITBOARD, ENGINE_TEMPORAL, ENGINE_HASHLIFE,
+                           ENGINE_OPENCL})
+    if (rule_runs(type, args.rule) &&
+        (type != ENGINE_OPENCL || cv::ocl::haveOpenCL()))
+      cases.push_back({type, args.simd, 0, {}, 0});
+
+  // populations are counted, and hashed, as they would be for --on-cycle
+  args.on_cycle = CYCLE_STOP;
+
+  for (cv::Size size : sizes) {
+    std::vector<uint8_t> frames;
+    std::vector<population> counts;
+    int matched = 0, tried = 0;
+
+    verify_reference(size.height, size.width, generations, seed, frames,
+                     counts);
+
+    for (verify_case c : cases)
+      for (int t : threads)
+        for (tile_size ts : tiles)
+          for (int stride : {1, VERIFY_STRIDE}) {
+            c.threads = t;
+            c.tile = ts;
+            c.stride = stride;
+            tried += 1;
+            matched += verify_run(c, size.height, size.width, seed, frames,
+                                  counts);
+          }
+
+    fprintf(console, "%dx%d: %d of %d runs match the reference\n",
+            size.width, size.height, matched, tried);
+    fflush(console);
+    runs += tried;
+    failures += tried - matched;
+  }
+
+  if (failures)
+    fprintf(stderr, "%d of %d runs differ from the reference\n", failures,
+            runs);
+  else
+    fprintf(console, "All %d runs over %d generations (seed %llu) match the "
+            "reference\n", runs, generations, (unsigned long long)seed);
+
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * @brief Draw the first state of a cell of a grid checked by --verify.
+ *
+ * Unlike seed_random(), cells start in every state and reach the edges of
+ * the grid, next to a quiet region (the top left quarter) the engines tracking
+ * activity skip until the cells spread into it.
+ *
+ * @param i Row of the cell.
+ * @param j Column of the cell.
+ * @param rows Number of rows in the grid.
+ * @param cols Number of columns in the grid.
+ * @param seed Seed of the random number generator.
+ * @return uint8_t State of the cell.
+ */
+static inline uint8_t verify_cell(const int i, const int j, const int rows,
+                                  const int cols, const uint64_t seed) {
+  const uint64_t z = random_word(seed, (uint64_t)i * cols + j);
+  const bool quiet = i < rows / 2 && j < cols / 2;
+
+  // a quarter of the cells are not off
+  return quiet || z % 4 ? CELL_OFF
+                        : CELL_ON + (z >> 2) % (args.rule.states - 1);
+}
+
+/**
+ * @brief Seed an engine with a grid checked by --verify (see verify_cell()).
+ *
+ * @param e Engine to seed.
+ * @param seed Seed of the random number generator.
+ */
+static void verify_seed(engine &e, const uint64_t seed) {
+  const int rows = e.rows(), cols = e.cols();
+  std::vector<uint8_t> row(cols);
+
+  for (int i = 0; i < rows; i += 1) {
+    for (int j = 0; j < cols; j += 1)
+      row[j] = verify_cell(i, j, rows, cols, seed);
+    e.write_row(i, row.data());
+  }
+}
+
+/**
+ * @brief Step a grid with the reference the engines are checked against.
+ *
+ * The reference shares no code with the engines: as the original brain() did,
+ * it counts the live cells around each cell of a flat array, one cell at a
+ * time and clipped at the edges of the grid, and applies the rule to it. The
+ * populations are counted cell by cell too.
+ *
+ * @param rows Number of rows in the grid.
+ * @param cols Number of columns in the grid.
+ * @param generations Number of generations to step.
+ * @param seed Seed the grid is drawn from (see verify_seed()).
+ * @param frames Receives the cells of each generation, one after the other.
+ * @param counts Receives the population of each generation.
+ */
+static void verify_reference(const int rows, const int cols,
+                             const int generations, const uint64_t seed,
+                             std::vector<uint8_t> &frames,
+                             std::vector<population> &counts) {
+  const automaton_rule &r = args.rule;
+  const size_t cells = (size_t)rows * cols;
+
+  frames.resize(cells * (generations + 1));
+  counts.resize(generations + 1);
+
+  for (int i = 0; i < rows; i += 1)
+    for (int j = 0; j < cols; j += 1)
+      frames[(size_t)i * cols + j] = verify_cell(i, j, rows, cols, seed);
+
+  for (int g = 0; g <= generations; g += 1) {
+    const uint8_t *in = &frames[(g ? g - 1 : 0) * cells];
+    uint8_t *out = &frames[g * cells];
+    population &p = counts[g];
+
+    for (int i = 0; g && i < rows; i += 1)
+      for (int j = 0; j < cols; j += 1) {
+        const uint8_t cell = in[(size_t)i * cols + j];
+        int tot = 0;
+
+        // search the neighborhood for live cells
+        for (int k = -1; k < 2; k += 1)
+          for (int l = -1; l < 2; l += 1)
+            if ((k || l) && i + k >= 0 && i + k < rows && j + l >= 0 &&
+                j + l < cols &&
+                (r.shape == NEIGHBORHOOD_MOORE || k == 0 || l == 0))
+              tot += in[(size_t)(i + k) * cols + j + l] == CELL_ON;
+
+        if (cell == CELL_OFF)
+          out[(size_t)i * cols + j] = r.birth >> tot & 1 ? CELL_ON : CELL_OFF;
+        else if (cell == CELL_ON)
+          out[(size_t)i * cols + j] = r.survive >> tot & 1 ? CELL_ON
+                                      : r.states > CELL_DYING ? CELL_DYING
+                                                              : CELL_OFF;
+        else
+          out[(size_t)i * cols + j] = cell + 1 < r.states ? cell + 1
+                                                          : CELL_OFF;
+      }
+
+    p = EMPTY_POPULATION;
+    for (int i = 0; i < rows; i += 1)
+      for (int j = 0; j < cols; j += 1) {
+        const uint8_t cell = out[(size_t)i * cols + j];
+
+        if (cell == CELL_OFF)
+          continue;
+        p.on += cell == CELL_ON;
+        p.dying += cell != CELL_ON;
+        p.top = std::min(p.top, i);
+        p.bottom = std::max(p.bottom, i);
+        p.left = std::min(p.left, j);
+        p.right = std::max(p.right, j);
+        p.hash += random_word(cell, (uint64_t)i << 32 | j);
+      }
+  }
+}
+
+/**
+ * @brief Check one way of running a grid against the reference.
+ *
+ * The first difference found is reported on stderr.
+ *
+ * @param c Engine, kernel, threads, tile and stride to run the grid with.
+ * @param rows Number of rows in the grid.
+ * @param cols Number of columns in the grid.
+ * @param seed Seed the grid is drawn from (see verify_seed()).
+ * @param frames Cells of each generation of the reference.
+ * @param counts Population of each generation of the reference.
+ * @return bool Whether every frame matches the reference.
+ */
+static bool verify_run(const verify_case &c, const int rows, const int cols,
+                       const uint64_t seed, const std::vector<uint8_t> &frames,
+                       const std::vector<population> &counts) {
+  const size_t cells = (size_t)rows * cols;
+  const int generations = counts.size() - 1;
+  std::vector<uint8_t> row(cols);
+  bool same = true;
+  engine *e;
+
+  args.simd = c.isa;
+  rule_apply();
+  tile = c.tile;
+#ifdef _OPENMP
+  omp_set_num_threads(c.threads);
+#endif
+
+  e = engine_create(c.type, rows, cols);
+  if (e == NULL)
+    exit(EXIT_FAILURE);
+  verify_seed(*e, seed);
+
+  for (int g = 0; same; g += c.stride) {
+    const uint8_t *ref = &frames[g * cells];
+    const population &q = counts[g];
+    population p;
+
+    for (int i = 0; i < rows && same; i += 1) {
+      e->read_row(i, row.data());
+      same = memcmp(row.data(), ref + (size_t)i * cols, cols) == 0;
+
+      if (!same) {
+        int j = 0;
+
+        while (row[j] == ref[(size_t)i * cols + j])
+          j += 1;
+        verify_describe(stderr, c, rows, cols);
+        fprintf(stderr, ": generation %d has state %d instead of %d at row "
+                "%d, column %d\n", g, row[j], ref[(size_t)i * cols + j], i, j);
+      }
+    }
+
+    census_take(*e, p);
+    if (same && (!census_same(p, q) || p.hash != q.hash)) {
+      verify_describe(stderr, c, rows, cols);
+      fprintf(stderr, ": generation %d counts %llu on and %llu dying cells in "
+              "rows %d to %d and columns %d to %d (hash %016llx) instead of "
+              "%llu and %llu in %d to %d and %d to %d (hash %016llx)\n", g,
+              (unsigned long long)p.on, (unsigned long long)p.dying, p.top,
+              p.bottom, p.left, p.right, (unsigned long long)p.hash,
+              (unsigned long long)q.on, (unsigned long long)q.dying, q.top,
+              q.bottom, q.left, q.right, (unsigned long long)q.hash);
+      same = false;
+    }
+
+    if (g + c.stride > generations)
+      break;
+    e->advance(c.stride);
+  }
+
+  delete e;
+
+  return same;
+}
+
+/**
+ * @brief Describe one way of running a grid checked by --verify.
+ *
+ * @param out Stream receiving the description.
+ * @param c Way of running the grid.
+ * @param rows Number of rows in the grid.
+ * @param cols Number of columns in the grid.
+ */
+static void verify_describe(FILE *out, const verify_case &c, const int rows,
+                            const int cols) {
+  fprintf(out, "%s engine (%s), %dx%d, %d thread%s, tile %dx%d, stride %d",
+          ENGINE_NAMES[c.type],
+          c.type == ENGINE_BYTE       ? SIMD_NAMES[resolve_isa(c.isa)]
+          : c.type == ENGINE_HASHLIFE ? "memoized"
+                                      : "bitwise",
+          cols, rows, c.threads, c.threads == 1 ? "" : "s", c.tile.rows,
+          c.tile.cols ? c.tile.cols : cols, c.stride);
+}
+
+/**
+ * @brief Pick the fastest traversal block for an engine.
+ *
+ * Every candidate block is timed over a few sweeps of the engine's current
+ * generation. Sweeps leave the current generation untouched, so tuning does
+ * not advance the simulation.
+ *
+ * @param e Engine to tune (already seeded).
+ * @return tile_size Fastest block.
+ */
+static tile_size autotune_tile(engine &e) {
+  static const tile_size candidates[] = TILE_CANDIDATES;
+  tile_size best = candidates[0];
+  double best_time = INFINITY;
+
+  for (tile_size t : candidates) {
+    tile = t;
+    e.sweep(); // warm up caches with this traversal order
+
+    double start = seconds();
+    for (int k = 0; k < TILE_TUNING_SWEEPS; k += 1)
+      e.sweep();
+    double elapsed = seconds() - start;
+
+    if (elapsed < best_time) {
+      best = t;
+      best_time = elapsed;
+    }
+  }
+
+  return best;
+}
+
+/**
+ * @brief Spell a rule out in the notation --rule takes.
+ *
+ * @param r Rule to spell out.
+ * @return std::string Rule such as B2/S/C3 (with a trailing V for the von
+ * Neumann neighborhood).
+ */
+static std::string rule_name(const automaton_rule &r) {
+  std::string name = "B";
+
+  for (int n = 0; n <= 8; n += 1)
+    if (r.birth >> n & 1)
+      name += '0' + n;
+  name += "/S";
+  for (int n = 0; n <= 8; n += 1)
+    if (r.survive >> n & 1)
+      name += '0' + n;
+  name += "/C" + std::to_string(r.states);
+  if (r.shape == NEIGHBORHOOD_VON_NEUMANN)
+    name += 'V';
+
+  return name;
+}
+
+/**
+ * @brief Fill the palettes with a shade per density level instead.
+ *
+ * Level d blends OFF into ON by d / (PALETTE_ENTRIES - 1).
+ */
+static void palette_fill_density(void) {
+  for (int d = 0; d < PALETTE_ENTRIES; d += 1) {
+    cv::Vec3b &bgr = palette_bgr[d];
+
+    for (int c = 0; c < 3; c += 1)
+      bgr[c] = (OFF[c] * (PALETTE_ENTRIES - 1 - d) + ON[c] * d) /
+               (PALETTE_ENTRIES - 1);
+    palette_rgb[d] = cv::Vec3b({bgr[2], bgr[1], bgr[0]});
+    palette_gray[d] = lround(0.114 * bgr[0] + 0.587 * bgr[1] + 0.299 * bgr[2]);
+  }
+}
+
+/**
+ * @brief Check whether two populations count the same cells in the same box.
+ *
+ * @param a First population.
+ * @param b Second population.
+ * @return bool Whether the counts and bounding boxes are equal.
+ */
+static bool census_same(const population &a, const population &b) {
+  return a.on == b.on && a.dying == b.dying && a.top == b.top &&
+         a.left == b.left && a.bottom == b.bottom && a.right == b.right;
+}
+
+/**
+ * @brief Open the file the population of every frame is written to.
+ *
+ * @param path File receiving the records ("-" for stdout).
+ * @param format Format of the records (csv files start with a header).
+ * @return FILE* Open file (close with fclose() unless it is stdout).
+ */
+static FILE *stats_open(const char *path, const record_format format) {
+  FILE *fp = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+
+  if (fp == NULL) {
+    perror("unable to open statistics file");
+    exit(EXIT_FAILURE);
+  }
+
+  if (format == STATS_CSV)
+    fprintf(fp, "generation,on,dying,off,top,left,bottom,right\n");
+
+  return fp;
+}
+
+/**
+ * @brief Write the population of the current generation of an engine.
+ *
+ * The bounding box is left empty (csv) or null (ndjson) when every cell is
+ * off.
+ *
+ * @param fp File receiving the record.
+ * @param format Format of the record.
+ * @param generation Generation the engine holds.
+ * @param e Engine holding the generation.
+ * @param p Population of the generation (see census_take()).
+ */
+static void stats_write(FILE *fp, const record_format format,
+                        const uint64_t generation, const engine &e,
+                        const population &p) {
+  const unsigned long long off =
+    (uint64_t)e.rows() * e.cols() - p.on - p.dying;
+  const bool empty = p.bottom < 0;
+
+  if (format == STATS_CSV) {
+    fprintf(fp, "%llu,%llu,%llu,%llu", (unsigned long long)generation,
+            (unsigned long long)p.on, (unsigned long long)p.dying, off);
+    if (empty)
+      fprintf(fp, ",,,,\n");
+    else
+      fprintf(fp, ",%d,%d,%d,%d\n", p.top, p.left, p.bottom, p.right);
+  } else {
+    fprintf(fp, "{\"generation\":%llu,\"on\":%llu,\"dying\":%llu,"
+            "\"off\":%llu,", (unsigned long long)generation,
+            (unsigned long long)p.on, (unsigned long long)p.dying, off);
+    if (empty)
+      fprintf(fp, "\"box\":null}\n");
+    else
+      fprintf(fp, "\"box\":[%d,%d,%d,%d]}\n", p.top, p.left, p.bottom,
+              p.right);
+  }
+}
+
+/**
+ * @brief Pack the current generation of an engine, as a checkpoint does.
+ *
+ * @param e Engine holding the generation.
+ * @param packed Receives the rows packed at the checkpoint's bits per cell.
+ */
+static void grid_pack(const engine &e, std::vector<uint8_t> &packed) {
+  const int rows = e.rows(), cols = e.cols();
+  const int bits = cell_states > 4 ? CHECKPOINT_WIDE_BITS : CHECKPOINT_BITS;
+  const size_t stride = tile_count(cols, 8 / bits);
+
+  packed.resize(stride * rows);
+
+#pragma omp parallel
+  {
+    std::vector<uint8_t> cells(cols);
+
+#pragma omp for
+    for (int i = 0; i < rows; i += 1) {
+      e.read_row(i, cells.data());
+      pack_row(cells.data(), &packed[i * stride], cols, bits);
+    }
+  }
+}
+
+/**
+ * @brief Look a frame up among the frames before it.
+ *
+ * A frame whose hash and population were seen within the last
+ * MAX_CYCLE_PERIOD frames becomes the candidate start of a cycle, unless
+ * there already is one. The cycle is found once the frame a period after
+ * the candidate holds the very same grid; if it does not, the hashes merely
+ * collided and the candidate is dropped. With --on-cycle repeat, the frames
+ * from the candidate on are kept by cycle_keep() unless they would take more
+ * than CYCLE_BYTES.
+ *
+ * @param w Frames watched so far.
+ * @param e Engine holding the frame's generation.
+ * @param p Population of the frame, counted with its hash.
+ * @param bytes Bytes a frame takes (0 if none is emitted).
+ * @return bool Whether the frame repeats the candidate, which it then starts
+ * repeating the cycle from.
+ */
+static bool cycle_check(cycle_watch &w, const engine &e, const population &p,
+                        const size_t bytes) {
+  const size_t slot = w.frames % MAX_CYCLE_PERIOD;
+
+  if (w.recent.empty())
+    w.recent.resize(MAX_CYCLE_PERIOD);
+
+  if (w.period && w.frames == w.start + w.period) {
+    std::vector<uint8_t> packed;
+
+    if (p.hash == w.candidate.hash && census_same(p, w.candidate)) {
+      grid_pack(e, packed);
+      w.found = packed == w.snapshot;
+    }
+    if (w.found) {
+      w.snapshot.clear();
+      w.next = 1 % w.period;
+      return true;
+    }
+
+    for (const cv::Mat &frame : w.loop)
+      arena_recycle(pool, frame);
+    w.loop.clear();
+    w.counts.clear();
+    w.period = 0;
+    w.repeat = false;
+  }
+
+  auto hit = w.seen.find(p.hash);
+  if (!w.period && hit != w.seen.end() &&
+      census_same(w.recent[hit->second % MAX_CYCLE_PERIOD], p)) {
+    w.period = w.frames - hit->second;
+    w.start = w.frames;
+    w.candidate = p;
+    w.repeat = args.on_cycle == CYCLE_REPEAT &&
+               (uint64_t)w.period * bytes <= CYCLE_BYTES;
+    grid_pack(e, w.snapshot);
+  }
+
+  // the frame falling out of the window is forgotten unless seen since
+  if (w.frames >= MAX_CYCLE_PERIOD) {
+    auto old = w.seen.find(w.recent[slot].hash);
+    if (old != w.seen.end() && old->second == w.frames - MAX_CYCLE_PERIOD)
+      w.seen.erase(old);
+  }
+  w.recent[slot] = p;
+  w.seen[p.hash] = w.frames;
+  w.frames += 1;
+
+  return false;
+}
+
+/**
+ * @brief Keep a frame of a cycle to repeat it.
+ *
+ * @param w Frames watched, with a candidate whose frames are kept.
+ * @param frame Frame to copy (empty if none is emitted).
+ * @param p Population of the frame.
+ */
+static void cycle_keep(cycle_watch &w, const cv::Mat &frame,
+                       const population &p) {
+  // the frame confirming the cycle is its first one again
+  if (w.counts.size() == (size_t)w.period)
+    return;
+
+  if (!frame.empty()) {
+    w.loop.push_back(arena_frame(pool, frame.rows, frame.cols, 1));
+    if (w.loop.back().empty())
+      exit(EXIT_FAILURE);
+    frame.copyTo(w.loop.back());
+  }
+  w.counts.push_back(p);
+}
+
+/**
+ * @brief Whether the frames of a cycle are all kept, to repeat from now on.
+ *
+ * @param w Frames watched.
+ * @return bool Whether the simulation can stop.
+ */
+static inline bool cycle_looping(const cycle_watch &w) {
+  return w.repeat && w.found;
+}
+
+/**
+ * @brief Move on to the next frame of a cycle being repeated.
+ *
+ * @param w Frames watched, with the frames of a cycle all kept.
+ * @return size_t Frame of the cycle to repeat (in loop and counts).
+ */
+static size_t cycle_next(cycle_watch &w) {
+  const size_t k = w.next;
+
+  w.next = (k + 1) % w.period;
+
+  return k;
+}
+
+/**
+ * @brief Report the cycle just found, and what the run does about it.
+ *
+ * @param w Frames watched, with a cycle just found.
+ * @param p Population of the frame repeating the candidate.
+ * @param generation Generation of the frame repeating the candidate.
+ */
+static void cycle_report(const cycle_watch &w, const population &p,
+                         const uint64_t generation) {
+  const uint64_t span = (uint64_t)w.period * args.frame_stride;
+  const char *action = args.on_cycle == CYCLE_STOP ? "stopping"
+                       : w.repeat ? "repeating its frames"
+                                  : "simulating on (too long to repeat)";
+
+  if (p.on + p.dying == 0 && w.period == 1)
+    fprintf(console, "\33[2K\rAll cells were off by generation %llu, %s\n",
+            (unsigned long long)(generation - span), action);
+  else
+    fprintf(console, "\33[2K\rGeneration %llu repeats generation %llu, %s\n",
+            (unsigned long long)generation,
+            (unsigned long long)(generation - span), action);
+}
+
+/**
+ * @brief Lay the frames out over a grid from --viewport and --scale.
+ *
+ * @param rows Number of rows in the grid.
+ * @param cols Number of columns in the grid.
+ * @return bool Whether the viewport lies within the grid.
+ */
+static bool view_apply(const int rows, const int cols) {
+  const cv::Rect &v = args.viewport;
+
+  view.rows = v.width ? v.height : rows;
+  view.cols = v.width ? v.width : cols;
+  view.top = args.placed ? v.y : (rows - view.rows) / 2;
+  view.left = args.placed ? v.x : (cols - view.cols) / 2;
+  view.scale = args.scale;
+  view.mode = args.scale_mode;
+  view.height = tile_count(view.rows, view.scale);
+  view.width = tile_count(view.cols, view.scale);
+  view.cropped = view.scale > 1 || view.rows != rows || view.cols != cols;
+
+  return view.top >= 0 && view.left >= 0 && view.top + view.rows <= rows &&
+         view.left + view.cols <= cols;
+}
+
+/**
+ * @brief Restore an engine from a checkpoint file.
+ *
+ * The file is mapped rather than read, so only the packed grid is ever paged
+ * in and nothing is simulated again. The checkpoint has to have been written
+ * under the same --rule.
+ *
+ * @param path Checkpoint written by checkpoint_save().
+ * @param type Engine to restore the grid into.
+ * @param generation Receives the generation saved in the checkpoint.
+ * @param seed Receives the seed of the run that wrote the checkpoint.
+ * @return engine* New engine holding the saved generation.
+ */
+static engine *checkpoint_load(const char *path, const engine_type type,
+                               uint64_t &generation, uint64_t &seed) {
+  checkpoint_header header;
+  struct stat st;
+  size_t stride;
+  uint8_t *map;
+  engine *e;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror("unable to open checkpoint");
+    exit(EXIT_FAILURE);
+  }
+  if ((size_t)st.st_size < sizeof(header)) {
+    fprintf(stderr, "not a checkpoint: %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  map = (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror("unable to map checkpoint");
+    exit(EXIT_FAILURE);
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  memcpy(&header, map, sizeof(header));
+
+  // reject anything but a complete checkpoint of a grid this program can hold
+  if (header.version == 1)
+    header.bits = CHECKPOINT_BITS;
+  if (header.bits != CHECKPOINT_BITS && header.bits != CHECKPOINT_WIDE_BITS)
+    header.version = 0;
+  stride = tile_count(header.cols, 8 / header.bits);
+  if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version == 0 || header.version > CHECKPOINT_VERSION ||
+      header.rows == 0 ||
+      header.cols == 0 || header.rows > MAX_GRID_SIZE ||
+      header.cols > MAX_GRID_SIZE ||
+      (size_t)st.st_size != sizeof(header) + stride * header.rows) {
+    fprintf(stderr, "not a checkpoint: %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  // the first version only ran Brian's Brain, while the second ran any rule
+  // without saying which (its cells still have to fit the rule given)
+  automaton_rule rule = {header.birth, header.survive, header.states,
+                         (neighborhood)header.shape};
+  if (header.version == 1)
+    rule = RULES[0].rule;
+  if (header.version == 2) {
+    fprintf(stderr, "checkpoint does not record its rule, resuming it under "
+            "%s: %s\n", rule_name(args.rule).c_str(), path);
+    rule = args.rule;
+  }
+  if (!same_rule(rule, args.rule)) {
+    fprintf(stderr, "checkpoint was written under the rule %s, not %s: %s\n",
+            rule_name(rule).c_str(), rule_name(args.rule).c_str(), path);
+    exit(EXIT_FAILURE);
+  }
+
+  e = engine_create(type, header.rows, header.cols);
+  if (e == NULL)
+    exit(EXIT_FAILURE);
+  std::vector<uint8_t> cells(header.cols);
+
+  for (uint32_t i = 0; i < header.rows; i += 1) {
+    if (!unpack_row(map + sizeof(header) + i * stride, cells.data(),
+                    header.cols, header.bits)) {
+      fprintf(stderr, "corrupt checkpoint: %s\n", path);
+      exit(EXIT_FAILURE);
+    }
+    e->write_row(i, cells.data());
+  }
+
+  munmap(map, st.st_size);
+  generation = header.generation;
+  seed = header.seed;
+
+  return e;
+}
+
+/**
+ * @brief Save the current generation of an engine to a checkpoint file.
+ *
+ * The checkpoint is written next to path and renamed over it once it is on
+ * disk, so an interrupted save never replaces the previous checkpoint with a
+ * partial one. A failed save is reported but does not stop the run.
+ *
+ * @param e Engine to save.
+ * @param path Destination of the checkpoint.
+ * @param generation Generations simulated since the grid was seeded.
+ * @param seed Seed of the random initialization.
+ * @return bool Whether the checkpoint was saved.
+ */
+static bool checkpoint_save(const engine &e, const char *path,
+                            const uint64_t generation, const uint64_t seed) {
+  const int rows = e.rows(), cols = e.cols();
+  const int bits = cell_states > 4 ? CHECKPOINT_WIDE_BITS : CHECKPOINT_BITS;
+  const size_t stride = tile_count(cols, 8 / bits);
+  const size_t size = sizeof(checkpoint_header) + stride * rows;
+  const std::string temp = std::string(path) + ".tmp";
+  checkpoint_header header = {};
+  uint8_t *map = (uint8_t *)MAP_FAILED;
+  bool saved;
+  int fd;
+
+  fd = open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd >= 0 && ftruncate(fd, size) == 0)
+    map = (uint8_t *)mmap(NULL, size, PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    perror("unable to write checkpoint");
+    if (fd >= 0) {
+      close(fd);
+      unlink(temp.c_str());
+    }
+    return false;
+  }
+
+  memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+  header.version = CHECKPOINT_VERSION;
+  header.rows = rows;
+  header.cols = cols;
+  header.bits = bits;
+  header.generation = generation;
+  header.seed = seed;
+  header.birth = args.rule.birth;
+  header.survive = args.rule.survive;
+  header.states = args.rule.states;
+  header.shape = args.rule.shape;
+  memcpy(map, &header, sizeof(header));
+
+  // rows are packed straight into the mapped file
+#pragma omp parallel
+  {
+    std::vector<uint8_t> cells(cols);
+
+#pragma omp for
+    for (int i = 0; i < rows; i += 1) {
+      e.read_row(i, cells.data());
+      pack_row(cells.data(), map + sizeof(header) + i * stride, cols, bits);
+    }
+  }
+
+  // the new checkpoint must be durable before it replaces the old one
+  saved = msync(map, size, MS_SYNC) == 0;
+  munmap(map, size);
+  saved = saved && fsync(fd) == 0;
+  close(fd);
+  saved = saved && rename(temp.c_str(), path) == 0;
+
+  if (!saved) {
+    perror("unable to write checkpoint");
+    unlink(temp.c_str());
+  }
+
+  return saved;
+}
+
+/**
+ * @brief Ask the frame loop to stop and save a checkpoint.
+ *
+ * @param signal Signal received (SIGINT or SIGTERM).
+ */
+static void handle_interrupt(int signal) {
+  (void)signal;
+  interrupted = 1;
+}
+
+/**
+ * @brief Unpack a row of cell states packed by pack_row().
+ *
+ * @param packed Row packed at bits per cell.
+ * @param cells Receives cols cell states.
+ * @param cols Number of cells in the row.
+ * @param bits Bits per cell (CHECKPOINT_BITS or CHECKPOINT_WIDE_BITS).
+ * @return bool Whether every packed value is a cell state of the rule.
+ */
+static bool unpack_row(const uint8_t *__restrict__ packed,
+                       uint8_t *__restrict__ cells, const int cols,
+                       const int bits) {
+  const int per_byte = 8 / bits;
+  uint8_t bad = 0;
+
+  for (int j = 0; j < cols; j += 1) {
+    cells[j] = (packed[j / per_byte] >> (bits * (j % per_byte))) &
+               ((1 << bits) - 1);
+    bad |= cells[j] >= cell_states;
+  }
+
+  return !bad;
+}
+
+/**
+ * @brief Apply the changes encoded by delta_encode() to a packed grid.
+ *
+ * @param src Encoded changes.
+ * @param end End of the bytes the changes may be read from.
+ * @param dst Packed grid of the frame before (zeros for a key frame), which
+ * receives the grid of the frame encoded.
+ * @param n Bytes in the grid.
+ * @return bool Whether the changes were complete and fit the grid.
+ */
+static bool delta_decode(const uint8_t *src, const uint8_t *end,
+                         uint8_t *__restrict__ dst, const size_t n) {
+  uint64_t same, changed;
+
+  for (size_t k = 0; k < n;) {
+    if (!varint_get(src, end, same) || !varint_get(src, end, changed) ||
+        same > n - k || changed > n - k - same ||
+        changed > (uint64_t)(end - src))
+      return false;
+
+    for (k += same; changed > 0; changed -= 1)
+      dst[k++] ^= *src++;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Read a varint written by varint_put().
+ *
+ * @param src Bytes to read from, advanced past the varint.
+ * @param end End of the bytes that may be read.
+ * @param value Receives the count.
+ * @return bool Whether a whole varint was read.
+ */
+static bool varint_get(const uint8_t *&src, const uint8_t *end,
+                       uint64_t &value) {
+  value = 0;
+
+  for (int shift = 0; src < end && shift < 64; shift += 7) {
+    value |= (uint64_t)(*src & 0x7f) << shift;
+    if ((*src++ & 0x80) == 0)
+      return true;
+  }
+
+  return false;
+}
+
+#ifdef USE_TRACE
+/**
+ * @brief Write the spans recorded to the --trace file once the run ends.
+ */
+static void trace_finish(void) {
+  std::lock_guard<std::mutex> guard(trace_lock);
+
+  trace_write(args.trace);
+}
+
+/**
+ * @brief Write the spans recorded as a Chrome trace and summarize them.
+ *
+ * Every span becomes a complete event of its thread, with its counters as
+ * arguments. The imbalance of each parallel region (its slowest thread's span
+ * over the mean span of its threads) is added as a counter track, and the
+ * summary printed shows how far static scheduling was from even.
+ *
+ * @param path File receiving the trace.
+ */
+static void trace_write(const char *path) {
+  typedef struct {
+    const char *name;
+    double start, longest, total;
+    int threads;
+  } region_spans;
+  std::unordered_map<uint64_t, region_spans> regions;
+  const pid_t pid = getpid();
+  double first = trace_events.empty() ? 0 : trace_events[0].start;
+  FILE *fp = fopen(path, "w");
+
+  if (fp == NULL) {
+    perror("unable to write trace");
+    return;
+  }
+
+  for (const trace_event &e : trace_events)
+    first = std::min(first, e.start);
+
+  fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (size_t k = 0; k < trace_events.size(); k += 1) {
+    const trace_event &e = trace_events[k];
+    const uint64_t *n = e.counts;
+
+    fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+            "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"cycles\":%llu,"
+            "\"instructions\":%llu,\"ipc\":%.3f,\"llc_misses\":%llu}},\n",
+            e.name, (int)pid, (int)e.tid, (e.start - first) * 1e6,
+            (e.end - e.start) * 1e6, (unsigned long long)n[TRACE_CYCLES],
+            (unsigned long long)n[TRACE_INSTRUCTIONS],
+            n[TRACE_CYCLES] ? (double)n[TRACE_INSTRUCTIONS] / n[TRACE_CYCLES]
+                            : 0.0,
+            (unsigned long long)n[TRACE_LLC_MISSES]);
+
+    if (e.region) {
+      region_spans &r = regions.try_emplace(
+        e.region, region_spans{e.name, e.start, 0, 0, 0}
+      ).first->second;
+
+      r.start = std::min(r.start, e.start);
+      r.longest = std::max(r.longest, e.end - e.start);
+      r.total += e.end - e.start;
+      r.threads += 1;
+    }
+  }
+
+  double imbalance = 0, worst = 0;
+
+  for (const auto &[id, r] : regions) {
+    const double ratio = r.total > 0 ? r.longest * r.threads / r.total : 1;
+
+    fprintf(fp, "{\"name\":\"imbalance\",\"ph\":\"C\",\"pid\":%d,"
+            "\"ts\":%.3f,\"args\":{\"%s\":%.3f}},\n", (int)pid,
+            (r.start - first) * 1e6, r.name, ratio);
+    imbalance += ratio;
+    worst = std::max(worst, ratio);
+  }
+
+  // the metadata event closes the array without a trailing comma
+  fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+          "\"args\":{\"name\":\"brains-brain\"}}\n]}\n", (int)pid);
+  fclose(fp);
+
+  fprintf(stderr, "traced %zu spans into %s", trace_events.size(), path);
+  if (!regions.empty())
+    fprintf(stderr, ", slowest thread of a step %.2fx the mean (worst "
+            "%.2fx)", imbalance / regions.size(), worst);
+  fprintf(stderr, "\n");
+}
+#endif
+
+/**
+ * @brief Display progress bar of how much of generation has happened.
+ *
+ * @param progress Amount of progress.
+ */
+static void display_progress(const int progress) {
+  if (progress < 0 || progress > MAX_PROGRESS)
+    return;
+
+  struct winsize sz;
+  int rsz_progress;
+
+  // get window size from tty
+  ioctl(fileno(console), TIOCGWINSZ, &sz);
+
+  // resize progress to match new progress bar size
   rsz_progress = (progress * sz.ws_row) / MAX_PROGRESS;
 
   // print progress bar using this weird C stynax
-  printf(
-    "\33[2K\rGenerating: [%.*s %.*s] %d%%", rsz_progress, PROGRESS_BAR,
+  fprintf(
+    console, "\33[2K\rGenerating: [%.*s %.*s] %d%%", rsz_progress, PROGRESS_BAR,
     sz.ws_row - rsz_progress, PROGRESS_BAR_BLANK, progress
   );
 
   // flush progress bar to user
   // clearing terminals is usually buffered
-  fflush(stdout);
+  fflush(console);
+}
+
+/**
+ * @brief Get the socket of a CPU.
+ *
+ * @param cpu Index of the CPU.
+ * @return int Physical package of the CPU (0 if unknown).
+ */
+static int cpu_package(const int cpu) {
+  char path[96];
+  int package = 0;
+  FILE *f;
+
+  snprintf(path, sizeof(path),
+           "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+  f = fopen(path, "r");
+  if (f) {
+    if (fscanf(f, "%d", &package) != 1 || package < 0)
+      package = 0;
+    fclose(f);
+  }
+
+  return package;
+}
+
+/**
+ * @brief Pin every OpenMP thread to one of the CPUs the program may run on.
+ *
+ * Threads keep their CPU from one parallel loop to the next, so each keeps
+ * stepping the rows it first touched in memory local to it.
+ *
+ * @param policy Placement of the threads (PIN_NONE to leave them be).
+ */
+static void pin_threads(const pin_policy policy) {
+  std::vector<std::vector<int>> packages;
+  std::vector<int> order;
+
+  if (policy == PIN_NONE)
+    return;
+
+  if (!pinned && sched_getaffinity(0, sizeof(startup_cpus), &startup_cpus)) {
+    perror("unable to pin threads");
+    return;
+  }
+  pinned = true;
+
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu += 1)
+    if (CPU_ISSET(cpu, &startup_cpus)) {
+      const int p = cpu_package(cpu);
+
+      if ((int)packages.size() <= p)
+        packages.resize(p + 1);
+      packages[p].push_back(cpu);
+    }
+
+  if (policy == PIN_COMPACT)
+    for (const std::vector<int> &cpus : packages)
+      order.insert(order.end(), cpus.begin(), cpus.end());
+  else
+    for (size_t k = 0; order.size() < (size_t)CPU_COUNT(&startup_cpus);
+         k += 1)
+      for (const std::vector<int> &cpus : packages)
+        if (k < cpus.size())
+          order.push_back(cpus[k]);
+
+#pragma omp parallel
+  {
+#ifdef _OPENMP
+    const int t = omp_get_thread_num();
+#else
+    const int t = 0;
+#endif
+    cpu_set_t cpu;
+
+    CPU_ZERO(&cpu);
+    CPU_SET(order[t % order.size()], &cpu);
+    sched_setaffinity(0, sizeof(cpu), &cpu);
+  }
+}
+
+/**
+ * @brief Let the calling thread run on any CPU it was first allowed on.
+ */
+static void unpin_thread(void) {
+  if (pinned)
+    sched_setaffinity(0, sizeof(startup_cpus), &startup_cpus);
+}
+
+/**
+ * @brief Encode frames from a ring until it is closed and drained.
+ *
+ * Frames the sink still references after writing them are only handed back
+ * once enough newer frames have been written.
+ *
+ * @param ring Ring receiving the frames from the simulation.
+ * @param out Sink receiving the frames.
+ */
+static void encode_frames(frame_ring &ring, sink &out) {
+  std::unique_lock<std::mutex> guard(ring.lock);
+  size_t held = 0; // frames written but still referenced by the sink
+
+  // started from a pinned thread, but shares no rows with any of them
+  unpin_thread();
+
+  for (;;) {
+    ring.filled.wait(guard, [&] { return ring.count > held || ring.closed; });
+    if (ring.count == held)
+      break;
+
+    // encode without holding the lock so the simulation can keep publishing
+    cv::Mat &frame = ring.slots[(ring.head + held) % ring.slots.size()].frame;
+    guard.unlock();
+    {
+      TRACE_SPAN("encode");
+      out.write(frame);
+    }
+    if (out.failed)
+      exit(EXIT_FAILURE);
+    guard.lock();
+
+    for (held += 1; held > (size_t)out.retained(); held -= 1) {
+      ring.head = (ring.head + 1) % ring.slots.size();
+      ring.count -= 1;
+    }
+    ring.drained.notify_one();
+  }
+}
+
+/**
+ * @brief Allocate the frames of a ring.
+ *
+ * @param ring Ring to initialize.
+ * @param depth Number of frames in the ring.
+ * @param rows Number of rows in each frame.
+ * @param cols Number of columns in each frame.
+ */
+static void ring_create(frame_ring &ring, const int depth, const int rows,
+                        const int cols) {
+  ring.slots.resize(depth);
+  for (frame_slot &slot : ring.slots) {
+    slot.frame = arena_frame(pool, rows, cols, 1);
+    slot.width = 0;
+    if (slot.frame.empty())
+      exit(EXIT_FAILURE);
+  }
+
+  ring.head = 0;
+  ring.count = 0;
+  ring.closed = false;
+}
+
+/**
+ * @brief Unmap every frame of an arena.
+ *
+ * @param a Arena to release (none of its frames may still be in use).
+ */
+static void arena_release(frame_arena &a) {
+  for (const std::pair<uint8_t *, size_t> &chunk : a.chunks)
+    munmap(chunk.first, chunk.second);
+
+  a.chunks.clear();
+  a.spare.clear();
+  a.used = 0;
+  a.allocations = 0;
+}
+
+/**
+ * @brief Wait for a free frame in a ring.
+ *
+ * The frame belongs to the caller until it is handed over with
+ * ring_publish().
+ *
+ * @param ring Ring to take the frame from.
+ * @return frame_slot& Frame to fill.
+ */
+static frame_slot &ring_acquire(frame_ring &ring) {
+  std::unique_lock<std::mutex> guard(ring.lock);
+
+  ring.drained.wait(guard, [&] { return ring.count < ring.slots.size(); });
+  return ring.slots[(ring.head + ring.count) % ring.slots.size()];
+}
+
+/**
+ * @brief Hand the frame returned by ring_acquire() over to the encoder.
+ *
+ * @param ring Ring the frame was taken from.
+ */
+static void ring_publish(frame_ring &ring) {
+  std::lock_guard<std::mutex> guard(ring.lock);
+
+  ring.count += 1;
+  ring.filled.notify_one();
+}
+
+/**
+ * @brief Signal the encoder that no more frames will be published.
+ *
+ * @param ring Ring to close.
+ */
+static void ring_close(frame_ring &ring) {
+  std::lock_guard<std::mutex> guard(ring.lock);
+
+  ring.closed = true;
+  ring.filled.notify_one();
+}
+
+/**
+ * @brief Prepare the mailbox of the preview for frames of a grid.
+ *
+ * Each preview pixel averages a square of cells, as few as still fit the grid
+ * in the window (or in the terminal, two pixels per character).
+ *
+ * @param p Mailbox to initialize.
+ * @param rows Number of rows in each frame.
+ * @param cols Number of columns in each frame.
+ */
+static void preview_create(preview_box &p, const int rows, const int cols) {
+  int width = PREVIEW_WIDTH, height = PREVIEW_HEIGHT;
+
+  if (args.preview == PREVIEW_TERMINAL) {
+    struct winsize sz;
+
+    // one line is left to the progress bar
+    width = 80;
+    height = 2 * 23;
+    if (ioctl(fileno(console), TIOCGWINSZ, &sz) == 0 && sz.ws_col > 0 &&
+        sz.ws_row > 1) {
+      width = sz.ws_col;
+      height = 2 * (sz.ws_row - 1);
+    }
+  }
+
+  p.scale = std::max({1, tile_count(cols, width), tile_count(rows, height)});
+  p.image = arena_frame(pool, tile_count(rows, p.scale),
+                        tile_count(cols, p.scale), 3);
+  if (p.image.empty())
+    exit(EXIT_FAILURE);
+  p.wanted = false;
+  p.ready = false;
+  p.closed = false;
+}
+
+/**
+ * @brief Hand a frame to the preview if it is waiting for one.
+ *
+ * @param p Mailbox of the preview.
+ * @param cells Frame of cell states just colorized.
+ */
+static void preview_offer(preview_box &p, const cv::Mat &cells) {
+  if (!p.wanted.exchange(false))
+    return;
+
+  preview_downsample(cells, p.image, p.scale);
+
+  std::lock_guard<std::mutex> guard(p.lock);
+  p.ready = true;
+  p.updated.notify_one();
+}
+
+/**
+ * @brief Tell the preview that no more frames will be offered.
+ *
+ * @param p Mailbox of the preview.
+ */
+static void preview_close(preview_box &p) {
+  std::lock_guard<std::mutex> guard(p.lock);
+  p.closed = true;
+  p.updated.notify_one();
+}
+
+/**
+ * @brief Show the frames offered to the preview until it is closed.
+ *
+ * At most args.preview_fps frames are asked for each second, so drawing never
+ * holds up the simulation and skipped frames are never downsampled.
+ *
+ * @param p Mailbox of the preview.
+ */
+static void preview_frames(preview_box &p) {
+  const auto period = std::chrono::microseconds(1000000 / args.preview_fps);
+  std::unique_lock<std::mutex> guard(p.lock);
+
+  // started from a pinned thread, but shares no rows with any of them
+  unpin_thread();
+
+  // the progress bar goes to the bottom line, below the picture
+  if (args.preview == PREVIEW_TERMINAL)
+    fprintf(console, "\33[2J\33[999;1H");
+  else
+    cv::namedWindow(PREVIEW_TITLE, cv::WINDOW_AUTOSIZE);
+
+  for (;;) {
+    const auto next = std::chrono::steady_clock::now() + period;
+
+    p.wanted = true;
+    p.updated.wait(guard, [&] { return p.ready || p.closed; });
+    if (!p.ready)
+      break;
+    p.ready = false;
+
+    // the image is only written again once the next frame is asked for
+    guard.unlock();
+    if (args.preview == PREVIEW_TERMINAL) {
+      preview_print(p.image);
+    } else {
+      cv::imshow(PREVIEW_TITLE, p.image);
+      cv::waitKey(1);
+    }
+    std::this_thread::sleep_until(next);
+    guard.lock();
+  }
+
+  if (args.preview == PREVIEW_WINDOW)
+    cv::destroyWindow(PREVIEW_TITLE);
+}
+
+/**
+ * @brief Shrink a frame of cell states into a BGR preview with a box filter.
+ *
+ * Rows of colours are summed a square of cells at a time in wide accumulators
+ * (which the compiler vectorizes), and every sum is then divided by the number
+ * of cells in its square (smaller along the right and bottom edges).
+ *
+ * @param cells Frame of cell states.
+ * @param image Preview (rows and columns of cells divided by scale, rounded
+ * up).
+ * @param scale Cells per side of each preview pixel.
+ */
+static void preview_downsample(const cv::Mat &cells, cv::Mat &image,
+                               const int scale) {
+  const int cols = cells.cols;
+
+#pragma omp parallel
+  {
+    std::vector<uint8_t> pixels((size_t)cols * 3);
+    std::vector<uint32_t> sums((size_t)cols * 3);
+
+#pragma omp for
+    for (int y = 0; y < image.rows; y += 1) {
+      const int i0 = y * scale, i1 = std::min(i0 + scale, cells.rows);
+      uint8_t *dst = image.ptr<uint8_t>(y);
+
+      std::fill(sums.begin(), sums.end(), 0);
+      for (int i = i0; i < i1; i += 1) {
+        palette_row(cells.ptr<uint8_t>(i), pixels.data(), cols,
+                    palette_bgr[0].val, 3);
+        for (int k = 0; k < 3 * cols; k += 1)
+          sums[k] += pixels[k];
+      }
+
+      for (int x = 0; x < image.cols; x += 1) {
+        const int j0 = x * scale, j1 = std::min(j0 + scale, cols);
+        const uint32_t n = (uint32_t)(i1 - i0) * (j1 - j0);
+
+        for (int c = 0; c < 3; c += 1) {
+          uint32_t sum = 0;
+
+          for (int j = j0; j < j1; j += 1)
+            sum += sums[3 * j + c];
+          dst[3 * x + c] = (sum + n / 2) / n;
+        }
+      }
+    }
+  }
+}
+
+/**
+ * @brief Draw a preview at the top of the terminal.
+ *
+ * Each character shows two preview pixels, the upper one as the foreground of
+ * a half block and the lower one as its background, in 24-bit colour. The
+ * picture is written at once so it does not tear with the progress bar below.
+ *
+ * @param image BGR preview.
+ */
+static void preview_print(const cv::Mat &image) {
+  std::string out = "\33[s\33[H";
+  char cell[48];
+
+  for (int y = 0; y < image.rows; y += 2) {
+    const uint8_t *up = image.ptr<uint8_t>(y);
+    const uint8_t *down = y + 1 < image.rows ? image.ptr<uint8_t>(y + 1) : up;
+
+    for (int x = 0; x < image.cols; x += 1) {
+      const uint8_t *a = up + 3 * x, *b = down + 3 * x;
+
+      // colours are only set again where they change
+      if (x == 0 || memcmp(a, a - 3, 3) != 0 || memcmp(b, b - 3, 3) != 0) {
+        snprintf(cell, sizeof(cell), "\33[38;2;%d;%d;%dm\33[48;2;%d;%d;%dm",
+                 a[2], a[1], a[0], b[2], b[1], b[0]);
+        out += cell;
+      }
+      out += "▀";
+    }
+    out += "\33[0m\33[K\n";
+  }
+  out += "\33[u";
+
+  fwrite(out.data(), 1, out.size(), console);
+  fflush(console);
+}
+
+/**
+ * @brief Parse a comma-separated list of positive counts.
+ *
+ * @param arg List given on the command line.
+ * @param counts Vector receiving the counts.
+ * @return bool Whether the whole list is valid.
+ */
+static bool parse_counts(const char *arg, std::vector<int> &counts) {
+  int count, used;
+
+  do {
+    if (sscanf(arg, "%d%n", &count, &used) != 1 || count <= 0)
+      return false;
+    counts.push_back(count);
+    arg += used;
+  } while (*arg++ == ',');
+
+  return arg[-1] == '\0';
+}
+
+/**
+ * @brief Parse a comma-separated list of resolutions.
+ *
+ * @param arg List of WIDTHxHEIGHT resolutions given on the command line.
+ * @param sizes Vector receiving the resolutions.
+ * @return bool Whether the whole list is valid.
+ */
+static bool parse_sizes(const char *arg, std::vector<cv::Size> &sizes) {
+  int width, height, used;
+
+  do {
+    if (sscanf(arg, "%dx%d%n", &width, &height, &used) != 2 || width <= 0 ||
+        height <= 0 || width > MAX_GRID_SIZE || height > MAX_GRID_SIZE)
+      return false;
+    sizes.push_back(cv::Size(width, height));
+    arg += used;
+  } while (*arg++ == ',');
+
+  return arg[-1] == '\0';
+}
+
+/**
+ * @brief Parse a viewport given as WxH, or as WxH+X+Y to place it.
+ *
+ * @param arg Viewport given on the command line.
+ * @param r Receives the size of the viewport (and its offsets if placed).
+ * @param placed Receives whether the offsets were given.
+ * @return bool Whether the viewport is valid.
+ */
+static bool parse_viewport(const char *arg, cv::Rect &r, bool &placed) {
+  int used, offsets = 0;
+
+  if (sscanf(arg, "%dx%d%n", &r.width, &r.height, &used) != 2)
+    return false;
+
+  placed = arg[used] != '\0';
+  if (placed && (sscanf(arg + used, "+%d+%d%n", &r.x, &r.y, &offsets) != 2 ||
+                 arg[used + offsets] != '\0'))
+    return false;
+
+  return r.width > 0 && r.height > 0 && r.width <= MAX_GRID_SIZE &&
+         r.height <= MAX_GRID_SIZE && (!placed || (r.x >= 0 && r.y >= 0 &&
+         r.x <= MAX_GRID_SIZE && r.y <= MAX_GRID_SIZE));
 }
 
 /**
@@ -251,10 +3811,18 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
   arguments *sargs = (arguments *)state->input;
   error_t rc = EXIT_SUCCESS;
 
-  if (key == 'f' || key == 'c' || key == 'r') {
+  if (key == 'f' || key == 'c' || key == 'r' || key == KEY_QUEUE ||
+      key == KEY_EVERY || key == KEY_STRIDE || key == KEY_DEPTH ||
+      key == KEY_VFPS || key == KEY_HMEM || key == KEY_ENCODE ||
+      key == KEY_SEGLEN || key == KEY_KEYINT || key == KEY_RFROM ||
+      key == KEY_THREAD || key == KEY_FPS || key == KEY_SCALE ||
+      key == KEY_TOL) {
     // convert argument to long integer
     char *endptr;
-    unsigned long value = strtoul(arg, &endptr, 10);
+    unsigned long value;
+
+    errno = 0;
+    value = strtoul(arg, &endptr, 10);
 
     // check conversion errors
     if (errno == EINVAL)
@@ -265,17 +3833,277 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
     // perform more detailed error checking based on specific key
     if (key == 'f') {
       sargs->frames = value;
+      sargs->framed = true;
     } else if (key == 'c') {
-      if (value >= USHRT_MAX)
-        argp_failure(state, 1, 0, "too many columns");
+      if (value < 1 || value > MAX_GRID_SIZE)
+        argp_failure(state, 1, 0, "columns must be between 1 and %d",
+                     MAX_GRID_SIZE);
       else
         sargs->columns = value;
     } else if (key == 'r') {
-      if (value >= USHRT_MAX)
-        argp_failure(state, 1, 0, "too many rows");
+      if (value < 1 || value > MAX_GRID_SIZE)
+        argp_failure(state, 1, 0, "rows must be between 1 and %d",
+                     MAX_GRID_SIZE);
       else
         sargs->rows = value;
+    } else if (key == KEY_QUEUE) {
+      if (value < 1 || value > INT_MAX)
+        argp_failure(state, 1, 0, "queue depth must be at least one frame");
+      else
+        sargs->queue_depth = value;
+    } else if (key == KEY_EVERY) {
+      if (value < 1 || value > INT_MAX)
+        argp_failure(state, 1, 0, "checkpoint interval must be at least one "
+                     "frame");
+      else
+        sargs->checkpoint_interval = value;
+    } else if (key == KEY_STRIDE) {
+      if (value < 1 || value > INT_MAX)
+        argp_failure(state, 1, 0, "frame stride must be at least one "
+                     "generation");
+      else
+        sargs->frame_stride = value;
+    } else if (key == KEY_DEPTH) {
+      if (value < 1 || value > MAX_TEMPORAL_DEPTH)
+        argp_failure(state, 1, 0, "temporal depth must be between 1 and %d "
+                     "generations", MAX_TEMPORAL_DEPTH);
+      else
+        sargs->temporal_depth = value;
+    } else if (key == KEY_VFPS) {
+      if (value < 1 || value > 1000)
+        argp_failure(state, 1, 0, "preview rate must be between 1 and 1000 "
+                     "refreshes per second");
+      else
+        sargs->preview_fps = value;
+    } else if (key == KEY_THREAD) {
+      if (value < 1 || value > 4096)
+        argp_failure(state, 1, 0, "threads must be between 1 and 4096");
+      else
+        sargs->threads = value;
+    } else if (key == KEY_KEYINT) {
+      if (value < 1 || value > INT_MAX)
+        argp_failure(state, 1, 0, "key frame interval must be at least one "
+                     "frame");
+      else
+        sargs->keyframe_interval = value;
+    } else if (key == KEY_RFROM) {
+      if (value > INT_MAX)
+        argp_failure(state, 1, 0, "first frame is out of range");
+      else
+        sargs->replay_from = value;
+    } else if (key == KEY_ENCODE) {
+      if (value < 1 || value > 256)
+        argp_failure(state, 1, 0, "encoders must be between 1 and 256");
+      else
+        sargs->encoders = value;
+    } else if (key == KEY_SEGLEN) {
+      if (value < 1 || value > INT_MAX)
+        argp_failure(state, 1, 0, "segments must be at least one frame");
+      else
+        sargs->segment_frames = value;
+    } else if (key == KEY_SCALE) {
+      if (value < 1 || value > MAX_SCALE)
+        argp_failure(state, 1, 0, "scale must be between 1 and %d cells a "
+                     "pixel", MAX_SCALE);
+      else
+        sargs->scale = value;
+    } else if (key == KEY_FPS) {
+      if (value < 1 || value > 1000)
+        argp_failure(state, 1, 0, "frame rate must be between 1 and 1000 "
+                     "frames per second");
+      else
+        sargs->fps = value;
+    } else if (key == KEY_TOL) {
+      if (value > 100)
+        argp_failure(state, 1, 0, "tolerance must be between 0 and 100 "
+                     "percent");
+      else
+        sargs->bench_tolerance = value;
+    } else if (key == KEY_HMEM) {
+      if (value < 1 || value > INT_MAX)
+        argp_failure(state, 1, 0, "hash memory must be at least one megabyte");
+      else
+        sargs->hash_memory = value;
+    }
+  } else if (key == KEY_SIMD) {
+    int isa = lookup_name(
+      SIMD_NAMES, sizeof(SIMD_NAMES) / sizeof(*SIMD_NAMES), arg
+    );
+
+    if (isa < 0)
+      argp_failure(state, 1, 0, "unknown instruction set: %s", arg);
+    else if (!simd_supported((simd_isa)isa))
+      argp_failure(state, 1, 0, "instruction set not supported: %s", arg);
+    else
+      sargs->simd = (simd_isa)isa;
+  } else if (key == KEY_TILE) {
+    tile_size t;
+    char end;
+
+    if (strcmp(arg, "auto") == 0)
+      sargs->autotune = true;
+    else if (sscanf(arg, "%dx%d%c", &t.rows, &t.cols, &end) != 2 ||
+             t.rows <= 0 || t.cols <= 0)
+      argp_failure(state, 1, 0, "tile must be auto or ROWSxCOLS: %s", arg);
+    else {
+      sargs->autotune = false;
+      sargs->tile = t;
+    }
+  } else if (key == KEY_BENCH) {
+    sargs->benchmark = true;
+  } else if (key == KEY_SIZES) {
+    std::vector<cv::Size> sizes;
+
+    if (!parse_sizes(arg, sizes))
+      argp_failure(state, 1, 0, "sizes must be WIDTHxHEIGHT,...: %s", arg);
+    else
+      sargs->bench_sizes = arg;
+  } else if (key == KEY_CORES) {
+    std::vector<int> counts;
+
+    if (!parse_counts(arg, counts))
+      argp_failure(state, 1, 0, "thread counts must be N,...: %s", arg);
+    else
+      sargs->bench_threads = arg;
+  } else if (key == KEY_JSON) {
+    sargs->bench_json = arg;
+  } else if (key == KEY_HIST) {
+    sargs->bench_history = arg;
+  } else if (key == KEY_VERIFY) {
+    sargs->verify = true;
+  } else if (key == KEY_SEED) {
+    char *endptr;
+
+    errno = 0;
+    sargs->seed = strtoull(arg, &endptr, 0);
+    if (errno != 0 || *arg == '\0' || *endptr != '\0')
+      argp_failure(state, 1, 0, "seed must be an unsigned integer: %s", arg);
+    else
+      sargs->seeded = true;
+  } else if (key == KEY_RULE) {
+    if (!parse_rule(arg, sargs->rule))
+      argp_failure(state, 1, 0, "unknown rule: %s", arg);
+  } else if (key == KEY_VIEW) {
+    int mode = arg ? lookup_name(
+                       PREVIEW_NAMES, sizeof(PREVIEW_NAMES) /
+                                        sizeof(*PREVIEW_NAMES), arg
+                     )
+                   : PREVIEW_WINDOW;
+
+    if (mode < 0)
+      argp_failure(state, 1, 0, "unknown preview: %s", arg);
+    else
+      sargs->preview = (preview_mode)mode;
+  } else if (key == KEY_SCHED) {
+    const char *comma = strchr(arg, ',');
+    const std::string name(arg, comma ? comma - arg : strlen(arg));
+    int kind = lookup_name(
+      SCHEDULE_NAMES, sizeof(SCHEDULE_NAMES) / sizeof(*SCHEDULE_NAMES),
+      name.c_str()
+    );
+    char *endptr = NULL;
+    long chunk = comma ? strtol(comma + 1, &endptr, 10) : 0;
+
+    if (kind < 0)
+      argp_failure(state, 1, 0, "unknown schedule: %s", arg);
+    else if (comma && (*endptr != '\0' || chunk < 1 || chunk > INT_MAX))
+      argp_failure(state, 1, 0, "chunk must be at least one tile: %s", arg);
+    else {
+      sargs->schedule = (schedule_kind)kind;
+      sargs->chunk = chunk;
     }
+  } else if (key == KEY_JOBS) {
+    sargs->jobs = arg;
+  } else if (key == KEY_VPORT) {
+    if (!parse_viewport(arg, sargs->viewport, sargs->placed))
+      argp_failure(state, 1, 0, "invalid viewport: %s", arg);
+  } else if (key == KEY_SMODE) {
+    int mode = lookup_name(
+      SCALE_NAMES, sizeof(SCALE_NAMES) / sizeof(*SCALE_NAMES), arg
+    );
+
+    if (mode < 0)
+      argp_failure(state, 1, 0, "unknown scale mode: %s", arg);
+    else
+      sargs->scale_mode = (scale_kind)mode;
+  } else if (key == KEY_CODEC) {
+    // handed to ffmpeg as an argument of its own
+    if (*arg == '\0' || *arg == '-')
+      argp_failure(state, 1, 0, "unknown codec: %s", arg);
+    else
+      sargs->codec = arg;
+  } else if (key == KEY_RATE) {
+    char *end;
+
+    if (strtoul(arg, &end, 10) == 0 || end == arg ||
+        (*end != '\0' && (strchr("kKMG", *end) == NULL || end[1] != '\0')))
+      argp_failure(state, 1, 0, "bit rate must be a number of bits, "
+                   "optionally with a k, M or G suffix: %s", arg);
+    else
+      sargs->bitrate = arg;
+  } else if (key == KEY_TRACE) {
+    sargs->trace = arg;
+  } else if (key == KEY_REPLAY) {
+    sargs->replay = arg;
+  } else if (key == KEY_KEEP) {
+    sargs->keep_segments = true;
+  } else if (key == KEY_HUGE) {
+    sargs->huge_pages = true;
+  } else if (key == KEY_PIN) {
+    int policy = lookup_name(
+      PIN_NAMES, sizeof(PIN_NAMES) / sizeof(*PIN_NAMES), arg
+    );
+
+    if (policy < 0)
+      argp_failure(state, 1, 0, "unknown pinning policy: %s", arg);
+    else
+      sargs->pin = (pin_policy)policy;
+  } else if (key == KEY_CKPT) {
+    sargs->checkpoint = arg;
+  } else if (key == KEY_RESUME) {
+    sargs->resume = arg;
+  } else if (key == 'o') {
+    sargs->output = arg;
+  } else if (key == KEY_STATS) {
+    sargs->stats = arg;
+  } else if (key == KEY_SFMT) {
+    int format = lookup_name(
+      STATS_NAMES, sizeof(STATS_NAMES) / sizeof(*STATS_NAMES), arg
+    );
+
+    if (format < 0)
+      argp_failure(state, 1, 0, "unknown statistics format: %s", arg);
+    else
+      sargs->stats_format = (record_format)format;
+  } else if (key == KEY_CYCLE) {
+    int action = lookup_name(
+      CYCLE_NAMES, sizeof(CYCLE_NAMES) / sizeof(*CYCLE_NAMES), arg
+    );
+
+    if (action < 0)
+      argp_failure(state, 1, 0, "unknown cycle action: %s", arg);
+    else
+      sargs->on_cycle = (cycle_action)action;
+  } else if (key == KEY_FORMAT) {
+    int format = lookup_name(
+      FORMAT_NAMES, sizeof(FORMAT_NAMES) / sizeof(*FORMAT_NAMES), arg
+    );
+
+    if (format < 0)
+      argp_failure(state, 1, 0, "unknown frame format: %s", arg);
+    else
+      sargs->format = (output_format)format;
+  } else if (key == KEY_ENGINE) {
+    int type = lookup_name(
+      ENGINE_NAMES, sizeof(ENGINE_NAMES) / sizeof(*ENGINE_NAMES), arg
+    );
+
+    if (type < 0)
+      argp_failure(state, 1, 0, "unknown engine: %s", arg);
+    else if (type == ENGINE_OPENCL && !cv::ocl::haveOpenCL())
+      argp_failure(state, 1, 0, "no OpenCL device available");
+    else
+      sargs->engine = (engine_type)type;
   } else {
     rc = ARGP_ERR_UNKNOWN;
   }